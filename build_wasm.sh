@@ -1,4 +1,4 @@
-emcc -std=c++17  -O3 -s ALLOW_MEMORY_GROWTH=1 -s TOTAL_MEMORY=500MB -s WASM=1  \
+emcc -std=c++17  -O3 -msimd128 -s ALLOW_MEMORY_GROWTH=1 -s TOTAL_MEMORY=500MB -s WASM=1  \
     -DWASM_COMPILE=1 src/slamWasm.cpp  third_party/lib/g2o/js/libg2o.a src/imageAnalysis/orbExtractor.cpp third_party/lib/opencv/js/libopencv_flann.a third_party/lib/opencv/js/libopencv_calib3d.a third_party/lib/opencv/js/libopencv_core.a third_party/lib/opencv/js/libopencv_features2d.a third_party/lib/opencv/js/libopencv_objdetect.a third_party/lib/opencv/js/libopencv_imgproc.a third_party/lib/opencv/js/libopencv_photo.a \
      -Ithird_party/include/opencv4 -Ithird_party/include/ -Ithird_party/src/ -o slam.html
 
@@ -28,15 +28,29 @@ const SlamConfig = {
     maxDepth: "75",
 
     matchHierarchy: "t",
+    matchMultiIndex: "f", //Exact multi-index hashing search of the descriptors, used instead of matchHierarchy when set
     leafSize: "27",
     branchSize: "3",
     treeSize: "3",
+    matchChecks: "128", //Descriptor distances computed per point by the best-bin-first search of the match trees
 
     reqdKpsInit: "1000",
     reqdKps: "500",
+    orbAngleBins: "30", //Set to 0 to rotate the ORB pattern for every keypoint instead of using angle bins
+    fastThHysteresis: "3", //Frames a low texture FAST cell keeps the low threshold for. 0 detects every frame from the high threshold
+    flatOctTree: "t", //Set to "f" to distribute keypoints with the list based octree of ORB-SLAM2
+    roiExtraction: "f", //After initialization, skip extraction in the cells well tracked on the previous frame
+    roiCellSize: "40", //Size in pixels of the cells of the tracked region mask
+    roiMinTracked: "3", //Points matched to landmarks for a cell to be skipped
+    roiSparseSize: "20", //Size in pixels of the window still extracted at the centre of a skipped cell, so its landmarks stay tracked. 0 skips the whole cell
+    roiMaxSkips: "4", //Frames in a row a cell can be skipped before it is extracted fully again
+    numThreads: "1", //Worker threads for parallel extraction. 0 or 1 runs serially. Ignored in WASM
+    pipelineDepth: "0", //Frames queued per stage of Slam::submit_frame. 0 runs extraction and pose estimation on the calling thread. Ignored in WASM
 
     maxGap: (100 * ratio).toString(), //300
     minGap: "2",
+    matchGridCell: "32", //Size in pixels of the keypoint grid cells used by the non hierarchical matcher
+    vocabMatchLevel: "2", //With a loaded vocabulary, only keypoints sharing their vocabulary node at this level (1 is below the root) are compared
     minAvgGapInit: "10",
     minAvgGap: "0",
     distanceThreshold: "64",
@@ -52,6 +66,10 @@ const SlamConfig = {
     maxFrames: "20",
     mapInitializationFrames: "2",
     numKeyFrameMatches: "4",//3
+    bowCandidates: "0", //Keyframes most similar by bag of words that are ranked by pose for matching, none when 0. Meant for a loaded vocabulary, without one it is trained on the first keyframe
+    covisibleCandidates: "10", //Keyframes sharing the most landmarks with the last tracked frame that are ranked by pose for matching, with the bowCandidates ones. All keyframes are ranked when both give fewer than numKeyFrameMatches
+    vocabBranchSize: "8", //Clusters per node of the vocabulary tree
+    vocabDepth: "3", //Levels of the vocabulary tree
     maxDistRatio: "0.2",
     maxAngle: "30",
     copyRotation: "t",
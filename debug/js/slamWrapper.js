@@ -66,7 +66,7 @@ const handleAcceleration = (event) => {
 }
 
 //Variables for SLAM
-let slam, imgBuffer, dataBuffer, float32DataBuffer, transferBuffer;
+let slam, imgBuffer, dataBuffer, float32DataBuffer;
 let started = false, modulesReady = new Set();
 
 //Initializes the SLAM module
@@ -95,7 +95,6 @@ const startSlamModule = ({width, height}) => {
   const dataBufferSize = Module._get_data_buffer_size();
   dataBuffer = Module._create_data_buffer();
   float32DataBuffer = new Float32Array(wasmMemory.buffer, dataBuffer, dataBufferSize);
-  transferBuffer = new Float32Array(dataBufferSize);
   // dataBuffer = new Float32Array(sizeDataBuffer*100);
   console.log("Created img buffer ", imgBuffer);
   console.log("Created data buffer ", dataBufferSize);
@@ -156,11 +155,18 @@ const processImage = ({imageData, x, y, z, order}) => {
 
     console.log("Extracting KPs");
     const extractStartTime = Date.now();
-    Module._extract_keypoints(slam, imgBuffer, imageData.height, imageData.width, dataBuffer);
+    const dataSize = Module._extract_keypoints(slam, imgBuffer, imageData.height, imageData.width, dataBuffer);
+    if (dataSize < 0) {
+      //Too many keypoints for the data buffer, the frame is dropped
+      console.error("Keypoint data exceeds the data buffer");
+      queueCount = queueCount - 1;
+      return;
+    }
         
-    transferBuffer.set(float32DataBuffer);
+    //Only the part of the buffer holding this frame is copied, and the copy is moved to the worker
+    const transferBuffer = float32DataBuffer.slice(0, dataSize);
     //Send keypoints to worker for pose detection
-    slamWorker.postMessage({operation: "process_keypoints", data: transferBuffer, x, y, z, order, timestamp: extractStartTime});
+    slamWorker.postMessage({operation: "process_keypoints", data: transferBuffer, x, y, z, order, timestamp: extractStartTime}, [transferBuffer.buffer]);
     kpExtractTime = Date.now() - extractStartTime;
   } else {
     //Send the image to worker. Both the keypoint extraction and pose detection will happen in worker
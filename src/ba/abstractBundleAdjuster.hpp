@@ -124,16 +124,16 @@ class AbstractBundleAdjuster {
                 const Mat& cameraMatrix, const Mat& distCoeffs, int weight = 1) {
             double u = 0, v = 0;
             if (normalizeKP) {
-                vector<cv::Point2f> keypoints{Point2f(fp->x, fp->y)};
+                vector<cv::Point2f> keypoints{Point2f(fp->x(), fp->y())};
                 vector<cv::Point2f> undistortedKeypoints;
                 cv::undistortPoints(keypoints, undistortedKeypoints, cameraMatrix, distCoeffs);
                 auto undistort = undistortedKeypoints[0];
-                //cout<<fp->x<<","<<fp->y<<" Undistort "<<undistort.x<<", "<<undistort.y<<endl;
+                //cout<<fp->x()<<","<<fp->y()<<" Undistort "<<undistort.x<<", "<<undistort.y<<endl;
                 u = undistort.x;
                 v = undistort.y;
             } else {
-                u = fp->x;
-                v = fp->y;
+                u = fp->x();
+                v = fp->y();
             }
             addFramepoint(landmark->id, fp->frame->id, u, v, weight, fp->frame->id == _cfg.debugFrameId);
             fps.insert(fp);
@@ -173,12 +173,13 @@ class AbstractBundleAdjuster {
         /**
          * @brief Extract both camera and landmark estimates
          * 
+         * @param arena The maps are built on it, on the heap when null
          * @return tuple<SP<LandmarkTransMap>, SP<FramePoseMap>> 
          */
-        tuple<SP<LandmarkTransMap>, SP<FramePoseMap>> get_estimates() 
+        tuple<SP<LandmarkTransMap>, SP<FramePoseMap>> get_estimates(FrameArena* arena = nullptr) 
         {
-            auto framePoseMap = make_shared<FramePoseMap>();
-            auto landmarkEstimateMap = make_shared<LandmarkTransMap>();
+            auto framePoseMap = arena_shared<FramePoseMap>(arena, arena);
+            auto landmarkEstimateMap = arena_shared<LandmarkTransMap>(arena, arena);
             for (auto frame : frames) {
                 (*framePoseMap)[frame] = getPoseEstimate(frame);
             }
@@ -36,6 +36,8 @@ class EstimateValidator {
         SP<FrameManager> _fm;
         Mat _cameraMatrix;
         Mat _distCoeffs;
+        //Results of the validation go on it, on the heap when null
+        FrameArena* _arena;
 
         SP<Pose> get_frame_pose(
             SP<FramePoseMap> framePoseMap, 
@@ -58,7 +60,7 @@ class EstimateValidator {
         {
             // DEBUG_COUT(currFrameId<<": "<<fp->frame->id<<" Validating for Frame "<<landmark->id<<", "<<append<<", "<<debug<<endl);
             auto pose = get_frame_pose(framePoseMap, fp->frame);
-            auto output = make_shared<FpValidResult>();
+            auto output = arena_shared<FpValidResult>(_arena);
 
             //Where both the landmarks and frame is fixed, their FP is not under
             //evaluation and so, is ignored for our computation
@@ -135,12 +137,15 @@ class EstimateValidator {
                 SP<FrameSet> frameSet,
                 SP<LandmarkSet> fixedLandmarks,
                 SP<FrameSet> fixedFrames) {
-            auto landmarkResult = make_shared<LandmarkResult>();
-            auto frameResult = make_shared<FrameResult>();
-            auto fpLandmarkResult = make_shared<FpLandmarkResult>();
-            auto frameFpLs = make_shared<FrameFpLandmarks>();
+            auto landmarkResult = arena_shared<LandmarkResult>(_arena, _arena);
+            auto frameResult = arena_shared<FrameResult>(_arena, _arena);
+            auto fpLandmarkResult = arena_shared<FpLandmarkResult>(_arena, _arena);
+            auto frameFpLs = arena_shared<FrameFpLandmarks>(_arena, _arena);
 
-            for (auto f : *frameSet) (*frameFpLs)[f] = make_shared<FramePointLandmarkPairSet>();
+            using FpLandmarkTuple = tuple<SP<FramePoint>, SP<Landmark>, SP<FpValidResult>>;
+            vector<FpLandmarkTuple, ArenaAllocator<FpLandmarkTuple>> fpLandmarks(_arena);
+
+            for (auto f : *frameSet) (*frameFpLs)[f] = arena_shared<FramePointLandmarkPairVec>(_arena, _arena);
 
             for (auto landmark : *landmarkSet) {
                 if (fixedLandmarks->count(landmark) == 0) {
@@ -151,18 +156,25 @@ class EstimateValidator {
                     // DEBUG_COUT("Set Landmark "<<landmark->id<<": FIXED"<<endl);
                 }
 
-                auto fpValidResult = make_shared<FpValidResult>();
+                auto fpValidResult = arena_shared<FpValidResult>(_arena);
                 fpValidResult->result = UNSET;
                 for (auto fp : landmark->fps) {
                     if (frameSet->count(fp->frame) == 0) continue;
-                    (*fpLandmarkResult)[fp][landmark] = fpValidResult;
-                    (*frameFpLs)[fp->frame]->insert(make_pair(fp, landmark));
+                    fpLandmarks.push_back(make_tuple(fp, landmark, fpValidResult));
+                    (*frameFpLs)[fp->frame]->push_back(make_pair(fp, landmark));
                 }
             }
-            
-            FrameSet frames;
-            for (auto& [fp, lFpValidResults] : *fpLandmarkResult) 
+
+            //In slot order, so every entry is appended to fpLandmarkResult instead of inserted
+            std::sort(fpLandmarks.begin(), fpLandmarks.end(), [](const auto& a, const auto& b) {
+                if (get<0>(a) != get<0>(b)) return get<0>(a)->slot() < get<0>(b)->slot();
+                return get<1>(a)->slot() < get<1>(b)->slot();
+            });
+            FrameSet frames(_arena);
+            for (auto& [fp, landmark, fpValidResult] : fpLandmarks) {
+                (*fpLandmarkResult)[fp][landmark] = fpValidResult;
                 frames.insert(fp->frame);
+            }
             
             for (auto frame : frames) {
                 if (fixedFrames->count(frame) == 0) {
@@ -178,7 +190,7 @@ class EstimateValidator {
         }
 
         tuple<int, int> count_inliers(
-                SP<FramePointLandmarkPairSet> fpLandmarkPairs,
+                SP<FramePointLandmarkPairVec> fpLandmarkPairs,
                 SP<FpLandmarkResult> fpLandmarkResult,
                 SP<LandmarkResult> landmarkResult) {
             int inlier = 0, outlier = 0;
@@ -202,12 +214,14 @@ class EstimateValidator {
             SP<LandmarkManager> lm, 
             SP<FrameManager> fm, 
             const Mat& cameraMatrix, 
-            const Mat& distCoeffs) : 
+            const Mat& distCoeffs,
+            FrameArena* arena = nullptr) : 
             _slamCfg(slamCfg), 
             _lm(lm), 
             _fm(fm), 
             _cameraMatrix(cameraMatrix), 
-            _distCoeffs(distCoeffs) {}
+            _distCoeffs(distCoeffs),
+            _arena(arena) {}
 
         ~EstimateValidator() {}
 
@@ -239,7 +253,7 @@ class EstimateValidator {
                 SP<FrameSet> frameSet,
                 SP<LandmarkSet> fixedLandmarks,
                 SP<FrameSet> fixedFrames,
-                SP<map<SP<Frame>, int>> frameRank,
+                SP<FrameRank> frameRank,
                 int maxRank,
                 float inlierRange,
                 float goodLandmarkRatio,
@@ -271,7 +285,7 @@ class EstimateValidator {
                             isFrameFixed, 
                             isLandmarkFixed,
                             framePoseMap);
-                        (*fpLandmarkResult)[fp][landmark] = assessment;
+                        fpValidResult = assessment;
                         // DEBUG_COUT("Set FP "<<fp->id<<":"<<landmark->id<<": "<<assessment->result<<endl);
 
                         //If the FP comes to true or false against a fixed frame 
@@ -315,7 +329,7 @@ class EstimateValidator {
                 int rankUnderConsideration = 0;
 
                 while (rankUnderConsideration < maxRank) {
-                    FrameSet newValidFrames;
+                    FrameSet newValidFrames(_arena);
                     for (auto& [frame, rank] : *frameRank) {
                         // DEBUG_COUT("Considering "<<frame->id<<": "<<rank<<", "<<rankUnderConsideration<<endl);
                         if (rank != rankUnderConsideration) continue;
@@ -374,7 +388,7 @@ class EstimateValidator {
 
             bool isValid = validFrameRatio >= goodFrameRatio && avgInlierRatio >= goodAvgInlierRatio;
 
-            return make_shared<ValidatorOutput>(
+            return arena_shared<ValidatorOutput>(_arena,
                     landmarkTransMap, framePoseMap, 
                     landmarkResult, frameResult, fpLandmarkResult,
                     avgInlierRatio, validFrameRatio, isValid);
@@ -391,28 +405,27 @@ class EstimateValidator {
 
             landmarkResult->replace(orig, landmark);
 
-            FramePointSet fps;
-            fps.insert(orig->fps.begin(), orig->fps.end());
-            fps.insert(landmark->fps.begin(), landmark->fps.end());
-            
+            //Copied out before inserting, the values move when the maps grow
             for (auto& [fp, lFpValid] : *vo->fpLandmarkResult) {
                 if (lFpValid.count(orig) > 0) {
-                    lFpValid[landmark] = lFpValid[orig];
+                    auto fpValid = lFpValid.at(orig);
                     lFpValid.erase(orig);
+                    lFpValid[landmark] = fpValid;
                     // DEBUG_COUT(orig->id<<":"<<fp->id<<":"<<fp->frame->id<<": Has been erased "<<fp->id<<endl);
                 }
             }
             // DEBUG_COUT("fpLandmarkResult has been replaced"<<endl);
 
             if (vo->landmarkTransMap->count(orig) > 0) {
-                (*vo->landmarkTransMap)[landmark] = (*vo->landmarkTransMap)[orig];
+                Vector3d trans = vo->landmarkTransMap->at(orig);
                 vo->landmarkTransMap->erase(orig);
+                (*vo->landmarkTransMap)[landmark] = trans;
             }
 
             for (auto fp : landmark->fps) {
                 if (orig->fps.count(fp) == 0) {
                     //This is a new FP. Set it to UNSET
-                    auto output = make_shared<FpValidResult>();
+                    auto output = arena_shared<FpValidResult>(fpLandmarkResult->arena());
                     output->result = UNSET;
                     (*fpLandmarkResult)[fp][landmark] = output;
                 }
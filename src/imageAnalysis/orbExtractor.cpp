@@ -65,8 +65,13 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <vector>
 #include <iterator>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "orbExtractor.h"
 #include <iostream>
@@ -75,12 +80,21 @@
 using namespace cv;
 using namespace std;
 
+// OpenCV's universal intrinsics cover SSE2, NEON and WASM SIMD128. The emscripten
+// build only gets the WASM backend when compiled with -msimd128.
+#if CV_SIMD128 && (!defined(__EMSCRIPTEN__) || defined(__wasm_simd128__))
+#define ORB_SIMD128 1
+#else
+#define ORB_SIMD128 0
+#endif
+
 
 const int PATCH_SIZE = 31;
 const int HALF_PATCH_SIZE = 15;
 const int EDGE_THRESHOLD = 19;
 
 
+#if !ORB_SIMD128
 static float IC_Angle(const Mat& image, Point2f pt,  const vector<int> & u_max)
 {
     int m_01 = 0, m_10 = 0;
@@ -109,9 +123,20 @@ static float IC_Angle(const Mat& image, Point2f pt,  const vector<int> & u_max)
 
     return fastAtan2((float)m_01, (float)m_10);
 }
+#endif
+
 
+// Lanes of a row of the orientation weight tables, u = -HALF_PATCH_SIZE .. HALF_PATCH_SIZE+1
+const int ORIENT_ROW = 32;
 
 const float factorPI = (float)(CV_PI/180.f);
+
+static inline int angleBin(float angle, int nAngleBins)
+{
+    int bin = cvRound(angle*(nAngleBins/360.f));
+    if (bin >= nAngleBins) bin -= nAngleBins;
+    return bin;
+}
 static void computeOrbDescriptor(const KeyPoint& kpt,
                                  const Mat& img, const Point* pattern,
                                  uchar* desc)
@@ -153,6 +178,61 @@ static void computeOrbDescriptor(const KeyPoint& kpt,
     #undef GET_VALUE
 }
 
+// Same descriptor as computeOrbDescriptor, but the sampling pattern has already been
+// rotated for the keypoint's angle bin. px/py hold the 256 first points of every
+// comparison followed by the 256 second points, so bit k of the descriptor is
+// (point k < point 256+k) and lanes map directly onto descriptor bits.
+static void computeOrbDescriptorBinned(const KeyPoint& kpt,
+                                       const Mat& img, const int* px, const int* py,
+                                       uchar* desc)
+{
+    const uchar* center = &img.at<uchar>(cvRound(kpt.pt.y), cvRound(kpt.pt.x));
+    const int step = (int)img.step;
+
+#if defined(__AVX2__)
+    // Gathers read 4 bytes, so sample from center-3 and keep the top byte. This never
+    // reads past the last pixel of the image.
+    const int* base = (const int*)(center - 3);
+    const __m256i vstep = _mm256_set1_epi32(step);
+    for (int k = 0; k < 256; k += 8)
+    {
+        __m256i off0 = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(py + k)), vstep),
+            _mm256_loadu_si256((const __m256i*)(px + k)));
+        __m256i off1 = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(py + 256 + k)), vstep),
+            _mm256_loadu_si256((const __m256i*)(px + 256 + k)));
+        __m256i t0 = _mm256_srli_epi32(_mm256_i32gather_epi32(base, off0, 1), 24);
+        __m256i t1 = _mm256_srli_epi32(_mm256_i32gather_epi32(base, off1, 1), 24);
+        desc[k >> 3] = (uchar)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(t1, t0)));
+    }
+#else
+    uchar CV_DECL_ALIGNED(16) t0[256];
+    uchar CV_DECL_ALIGNED(16) t1[256];
+    for (int k = 0; k < 256; ++k)
+    {
+        t0[k] = center[py[k]*step + px[k]];
+        t1[k] = center[py[256 + k]*step + px[256 + k]];
+    }
+#if ORB_SIMD128
+    for (int k = 0; k < 256; k += 16)
+    {
+        int mask = v_signmask(v_load_aligned(t0 + k) < v_load_aligned(t1 + k));
+        desc[k >> 3] = (uchar)(mask & 0xff);
+        desc[(k >> 3) + 1] = (uchar)(mask >> 8);
+    }
+#else
+    for (int i = 0; i < 32; ++i)
+    {
+        int val = 0;
+        for (int j = 0; j < 8; ++j)
+            val |= (t0[i*8 + j] < t1[i*8 + j]) << j;
+        desc[i] = (uchar)val;
+    }
+#endif
+#endif
+}
+
 
 static int bit_pattern_31_[256*4] =
 {
@@ -415,9 +495,11 @@ static int bit_pattern_31_[256*4] =
 };
 
 ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
-         int _iniThFAST, int _minThFAST):
+         int _iniThFAST, int _minThFAST, int _nAngleBins, int _nThHysteresis, bool _bFlatOctTree,
+         ThreadPool* _threadPool):
     nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
-    iniThFAST(_iniThFAST), minThFAST(_minThFAST)
+    iniThFAST(_iniThFAST), minThFAST(_minThFAST), nAngleBins(_nAngleBins),
+    nThHysteresis(_nThHysteresis), bFlatOctTree(_bFlatOctTree), mpThreadPool(_threadPool)
 {
     mvScaleFactor.resize(nlevels);
     mvLevelSigma2.resize(nlevels);
@@ -438,6 +520,8 @@ ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
     }
 
     mvImagePyramid.resize(nlevels);
+    mvCellThState.resize(nlevels);
+    mvOctTreeBuffers.resize(nlevels);
 
     mnFeaturesPerLevel.resize(nlevels);
     float factor = 1.0f / scaleFactor;
@@ -456,6 +540,30 @@ ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
     const Point* pattern0 = (const Point*)bit_pattern_31_;
     std::copy(pattern0, pattern0 + npoints, std::back_inserter(pattern));
 
+    //Rotate the pattern once for every angle bin, so that descriptor computation
+    //is reduced to table lookups
+    if (nAngleBins > 0)
+    {
+        mvRotatedPatternX.resize(nAngleBins*npoints);
+        mvRotatedPatternY.resize(nAngleBins*npoints);
+        for (int bin = 0; bin < nAngleBins; bin++)
+        {
+            float angle = (float)bin*360.f/nAngleBins*factorPI;
+            float a = (float)cos(angle), b = (float)sin(angle);
+            int* px = &mvRotatedPatternX[bin*npoints];
+            int* py = &mvRotatedPatternY[bin*npoints];
+            for (int k = 0; k < npoints/2; k++)
+            {
+                const Point& p0 = pattern[2*k];
+                const Point& p1 = pattern[2*k + 1];
+                px[k] = cvRound(p0.x*a - p0.y*b);
+                py[k] = cvRound(p0.x*b + p0.y*a);
+                px[npoints/2 + k] = cvRound(p1.x*a - p1.y*b);
+                py[npoints/2 + k] = cvRound(p1.x*b + p1.y*a);
+            }
+        }
+    }
+
     //This is for orientation
     // pre-compute the end of a row in a circular patch
     umax.resize(HALF_PATCH_SIZE + 1);
@@ -474,14 +582,243 @@ ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
         umax[v] = v0;
         ++v0;
     }
+
+    mvOrientWeightsU.assign((HALF_PATCH_SIZE + 1)*ORIENT_ROW, 0);
+    mvOrientWeightsV.assign((HALF_PATCH_SIZE + 1)*ORIENT_ROW, 0);
+    for (v = 0; v <= HALF_PATCH_SIZE; ++v)
+    {
+        for (int u = -umax[v]; u <= umax[v]; ++u)
+        {
+            mvOrientWeightsU[v*ORIENT_ROW + u + HALF_PATCH_SIZE] = (short)u;
+            mvOrientWeightsV[v*ORIENT_ROW + u + HALF_PATCH_SIZE] = (short)v;
+        }
+    }
+    mvKeyPointBins.resize(nlevels);
+}
+
+//Runs fn(0) .. fn(n-1), on the thread pool when there is one. Callers write
+//results into per index slots and merge them in index order, so the output
+//does not depend on the scheduling.
+template<typename F>
+static void runTasks(ThreadPool* pool, int n, const F& fn)
+{
+    if (pool)
+        pool->parallel_for(0, n, fn);
+    else
+        for (int i = 0; i < n; i++)
+            fn(i);
+}
+
+// FAST-9 on the 16 pixel circle of radius 3, the same detector as OpenCV's FAST with
+// TYPE_9_16. Scores are computed per cell at the threshold the cell is detected at, and the
+// non-max suppression is done per cell, so every cell gives the keypoints cv::FAST would
+// give on that cell's image region.
+const int FAST_RING = 16;
+const int FAST_ARC = 9;
+
+static void makeFastOffsets(int pixel[FAST_RING + FAST_ARC], int rowStride)
+{
+    static const int offsets[FAST_RING][2] =
+    {
+        {0,  3}, { 1,  3}, { 2,  2}, { 3,  1}, { 3, 0}, { 3, -1}, { 2, -2}, { 1, -3},
+        {0, -3}, {-1, -3}, {-2, -2}, {-3, -1}, {-3, 0}, {-3,  1}, {-2,  2}, {-1,  3}
+    };
+    for (int k = 0; k < FAST_RING; k++)
+        pixel[k] = offsets[k][0] + offsets[k][1]*rowStride;
+    for (int k = FAST_RING; k < FAST_RING + FAST_ARC; k++)
+        pixel[k] = pixel[k - FAST_RING];
+}
+
+static inline bool isFastCorner(const uchar* ptr, const int* pixel, int threshold)
+{
+    const int vt = ptr[0] + threshold, v_t = ptr[0] - threshold;
+    // Every arc of 9 contains pixel 0 or pixel 8
+    const int x0 = ptr[pixel[0]], x8 = ptr[pixel[FAST_RING/2]];
+    if (x0 <= vt && x0 >= v_t && x8 <= vt && x8 >= v_t)
+        return false;
+
+    int c0 = 0, c1 = 0;
+    for (int k = 0; k < FAST_RING + FAST_ARC; k++)
+    {
+        const int x = ptr[pixel[k]];
+        if (x > vt)
+        {
+            if (++c0 >= FAST_ARC) return true;
+            c1 = 0;
+        }
+        else if (x < v_t)
+        {
+            if (++c1 >= FAST_ARC) return true;
+            c0 = 0;
+        }
+        else
+            c0 = c1 = 0;
+    }
+    return false;
+}
+
+// Largest threshold the pixel is still a corner for
+static inline int fastCornerScore(const uchar* ptr, const int* pixel)
+{
+    const int v = ptr[0];
+    int d[FAST_RING + FAST_ARC];
+    for (int k = 0; k < FAST_RING + FAST_ARC; k++)
+        d[k] = v - ptr[pixel[k]];
+
+    int a0 = 0, b0 = 0;
+    for (int k = 0; k < FAST_RING; k++)
+    {
+        int a = d[k], b = -d[k];
+        for (int m = 1; m < FAST_ARC; m++)
+        {
+            a = std::min(a, d[k + m]);
+            b = std::min(b, -d[k + m]);
+        }
+        a0 = std::max(a0, a);
+        b0 = std::max(b0, b);
+    }
+    return std::max(a0, b0) - 1;
+}
+
+// Writes the FAST score of the pixels [x0, x1) of a row, 0 for pixels which are not
+// corners at threshold
+static void computeFastScores(const uchar* row, uchar* scores, int x0, int x1,
+                              const int* pixel, int threshold)
+{
+    int x = x0;
+#if ORB_SIMD128
+    const v_uint8x16 delta = v_setall_u8(0x80), t = v_setall_u8((uchar)threshold);
+    const v_int8x16 K8 = v_setall_s8(FAST_ARC - 1);
+    for (; x <= x1 - 16; x += 16)
+    {
+        const uchar* ptr = row + x;
+        const v_uint8x16 v = v_load(ptr);
+        const v_int8x16 v0 = v_reinterpret_as_s8((v + t) ^ delta);
+        const v_int8x16 v1 = v_reinterpret_as_s8((v - t) ^ delta);
+
+        // Quick rejection on the 4 compass pixels, a corner has 2 adjacent ones on the same side
+        v_int8x16 x0v = v_reinterpret_as_s8(v_load(ptr + pixel[0]) ^ delta);
+        v_int8x16 x1v = v_reinterpret_as_s8(v_load(ptr + pixel[4]) ^ delta);
+        v_int8x16 x2v = v_reinterpret_as_s8(v_load(ptr + pixel[8]) ^ delta);
+        v_int8x16 x3v = v_reinterpret_as_s8(v_load(ptr + pixel[12]) ^ delta);
+        v_int8x16 m0 = ((v0 < x0v) & (v0 < x1v)) | ((v0 < x1v) & (v0 < x2v)) |
+                       ((v0 < x2v) & (v0 < x3v)) | ((v0 < x3v) & (v0 < x0v));
+        v_int8x16 m1 = ((x0v < v1) & (x1v < v1)) | ((x1v < v1) & (x2v < v1)) |
+                       ((x2v < v1) & (x3v < v1)) | ((x3v < v1) & (x0v < v1));
+        v_store(scores + x, v_setzero_u8());
+        if (!v_check_any(m0 | m1))
+            continue;
+
+        // Longest run of brighter / darker pixels around the circle
+        v_int8x16 c0 = v_setzero_s8(), c1 = v_setzero_s8();
+        v_int8x16 max0 = v_setzero_s8(), max1 = v_setzero_s8();
+        for (int k = 0; k < FAST_RING + FAST_ARC; k++)
+        {
+            const v_int8x16 xk = v_reinterpret_as_s8(v_load(ptr + pixel[k]) ^ delta);
+            m0 = v0 < xk;
+            m1 = xk < v1;
+            c0 = v_sub_wrap(c0, m0) & m0;
+            c1 = v_sub_wrap(c1, m1) & m1;
+            max0 = v_max(max0, c0);
+            max1 = v_max(max1, c1);
+        }
+        int mask = v_signmask(K8 < v_max(max0, max1));
+        for (int k = 0; mask; k++, mask >>= 1)
+            if (mask & 1)
+                scores[x + k] = (uchar)fastCornerScore(ptr + k, pixel);
+    }
+#endif
+    for (; x < x1; x++)
+    {
+        const uchar* ptr = row + x;
+        scores[x] = isFastCorner(ptr, pixel, threshold) ? (uchar)fastCornerScore(ptr, pixel) : 0;
+    }
 }
 
-static void computeOrientation(const Mat& image, vector<KeyPoint>& keypoints, const vector<int>& umax)
+// Non-max suppressed corners of the cell [x0, x1) x [y0, y1) at threshold. Pixels outside
+// the cell or below threshold don't suppress. Keypoints are added relative to origin.
+static void detectFastCell(const Mat& scores, int x0, int x1, int y0, int y1, int threshold,
+                           const Point2i& origin, vector<KeyPoint>& keypoints)
 {
-    for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
-         keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
+    for (int y = y0; y < y1; y++)
     {
-        keypoint->angle = IC_Angle(image, keypoint->pt, umax);
+        const uchar* curr = scores.ptr<uchar>(y);
+        for (int x = x0; x < x1; x++)
+        {
+            const int score = curr[x];
+            if (score < threshold)
+                continue;
+
+            bool isMax = true;
+            for (int dy = -1; dy <= 1 && isMax; dy++)
+            {
+                if (y + dy < y0 || y + dy >= y1)
+                    continue;
+                const uchar* row = scores.ptr<uchar>(y + dy);
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    if ((dx == 0 && dy == 0) || x + dx < x0 || x + dx >= x1)
+                        continue;
+                    const int neighbour = row[x + dx];
+                    if (neighbour >= threshold && neighbour >= score)
+                    {
+                        isMax = false;
+                        break;
+                    }
+                }
+            }
+            if (isMax)
+                keypoints.push_back(KeyPoint(Point2f((float)(x - origin.x), (float)(y - origin.y)),
+                                             7.f, -1, (float)score));
+        }
+    }
+}
+
+// IC_Angle of every keypoint. A patch row is two 16 pixel loads, and its moments are dot
+// products with the weight rows, so the sums are the same integers IC_Angle computes. With
+// nAngleBins > 0 the pattern bin of every keypoint is written to bins.
+static void computeOrientation(const Mat& image, vector<KeyPoint>& keypoints, const vector<int>& umax,
+                               const vector<short>& weightsU, const vector<short>& weightsV,
+                               int nAngleBins, vector<int>& bins)
+{
+    bins.resize(nAngleBins > 0 ? keypoints.size() : 0);
+    for (size_t i = 0; i < keypoints.size(); i++)
+    {
+        KeyPoint& kp = keypoints[i];
+#if ORB_SIMD128
+        const int step = (int)image.step1();
+        const uchar* center = &image.at<uchar>(cvRound(kp.pt.y), cvRound(kp.pt.x)) - HALF_PATCH_SIZE;
+        v_int32x4 m10 = v_setzero_s32(), m01 = v_setzero_s32();
+        v_uint16x8 p0, p1, q0, q1;
+
+        // The center line is counted once, v=0
+        v_expand(v_load(center), p0, p1);
+        v_expand(v_load(center + 16), q0, q1);
+        m10 += v_dotprod(v_reinterpret_as_s16(p0), v_load(&weightsU[0])) +
+               v_dotprod(v_reinterpret_as_s16(p1), v_load(&weightsU[8])) +
+               v_dotprod(v_reinterpret_as_s16(q0), v_load(&weightsU[16])) +
+               v_dotprod(v_reinterpret_as_s16(q1), v_load(&weightsU[24]));
+
+        for (int v = 1; v <= HALF_PATCH_SIZE; ++v)
+        {
+            const short* wu = &weightsU[v*ORIENT_ROW];
+            const short* wv = &weightsV[v*ORIENT_ROW];
+            for (int k = 0; k < ORIENT_ROW; k += 16)
+            {
+                v_expand(v_load(center + v*step + k), p0, p1);
+                v_expand(v_load(center - v*step + k), q0, q1);
+                m10 += v_dotprod(v_reinterpret_as_s16(p0 + q0), v_load(wu + k)) +
+                       v_dotprod(v_reinterpret_as_s16(p1 + q1), v_load(wu + k + 8));
+                m01 += v_dotprod(v_reinterpret_as_s16(p0) - v_reinterpret_as_s16(q0), v_load(wv + k)) +
+                       v_dotprod(v_reinterpret_as_s16(p1) - v_reinterpret_as_s16(q1), v_load(wv + k + 8));
+            }
+        }
+        kp.angle = fastAtan2((float)v_reduce_sum(m01), (float)v_reduce_sum(m10));
+#else
+        kp.angle = IC_Angle(image, kp.pt, umax);
+#endif
+        if (nAngleBins > 0)
+            bins[i] = angleBin(kp.angle, nAngleBins);
     }
 }
 
@@ -769,77 +1106,329 @@ vector<cv::KeyPoint> ORBextractor::DistributeOctTree(const vector<cv::KeyPoint>&
     return vResultKeys;
 }
 
-void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoints)
+// Splits a node of the flat quadtree in four like ExtractorNode::DivideNode, by partitioning
+// its index range in place. Children are in the order UL, UR, BL, BR and may be empty.
+static void DivideFlatNode(const FlatExtractorNode& node, const vector<cv::KeyPoint>& vKeys,
+                           vector<int>& vIndices, FlatExtractorNode children[4])
 {
-    allKeypoints.resize(nlevels);
+    const int halfX = ceil(static_cast<float>(node.maxX-node.minX)/2);
+    const int halfY = ceil(static_cast<float>(node.maxY-node.minY)/2);
+    const int midX = node.minX+halfX;
+    const int midY = node.minY+halfY;
+
+    int* first = vIndices.data();
+    int* mx = std::partition(first+node.begin, first+node.end,
+                             [&](int i) { return vKeys[i].pt.x<midX; });
+    int* my1 = std::partition(first+node.begin, mx, [&](int i) { return vKeys[i].pt.y<midY; });
+    int* my2 = std::partition(mx, first+node.end, [&](int i) { return vKeys[i].pt.y<midY; });
+    const int iMx = mx-first, iMy1 = my1-first, iMy2 = my2-first;
+
+    children[0] = {node.begin, iMy1, node.minX, node.minY, midX, midY};
+    children[1] = {iMx, iMy2, midX, node.minY, node.maxX, midY};
+    children[2] = {iMy1, iMx, node.minX, midY, midX, node.maxY};
+    children[3] = {iMy2, node.end, midX, midY, node.maxX, node.maxY};
+}
 
-    const float W = 30;
+// Same subdivision rules as DistributeOctTree, on ranges of an index array instead of
+// nodes owning copies of their keypoints. Ties between nodes of the same size are broken
+// by node position instead of node address, and the result is in node order.
+vector<cv::KeyPoint> ORBextractor::DistributeOctTreeFlat(const vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
+                                       const int &maxX, const int &minY, const int &maxY, const int &N, const int &level)
+{
+    OctTreeBuffers& buffers = mvOctTreeBuffers[level];
+    vector<int>& vIndices = buffers.vIndices;
+    vector<int>& vColumnStarts = buffers.vColumnStarts;
+    vector<FlatExtractorNode>& vNodes = buffers.vNodes;
+    vector<FlatExtractorNode>& vNextNodes = buffers.vNextNodes;
+    vector<pair<int,int> >& vToExpand = buffers.vToExpand;
+    vector<pair<int,int> >& vPrevToExpand = buffers.vPrevToExpand;
+
+    // Compute how many initial nodes
+    const int nIni = std::max((int)round(static_cast<float>(maxX-minX)/(maxY-minY)), 1);
+    const float hX = static_cast<float>(maxX-minX)/nIni;
+    const int nKeys = vToDistributeKeys.size();
+
+    // Counting sort of the keypoints into the initial nodes. Placing moves vColumnStarts[i]
+    // from the start of node i to its end, which is the start of node i+1.
+    vIndices.resize(nKeys);
+    vColumnStarts.assign(nIni+1, 0);
+    for(int i=0; i<nKeys; i++)
+        vColumnStarts[std::min((int)(vToDistributeKeys[i].pt.x/hX), nIni-1)+1]++;
+    for(int i=0; i<nIni; i++)
+        vColumnStarts[i+1] += vColumnStarts[i];
+    for(int i=0; i<nKeys; i++)
+        vIndices[vColumnStarts[std::min((int)(vToDistributeKeys[i].pt.x/hX), nIni-1)]++] = i;
 
-    for (int level = 0; level < nlevels; ++level)
+    vNodes.clear();
+    for(int i=0; i<nIni; i++)
     {
-        const int minBorderX = EDGE_THRESHOLD-3;
-        const int minBorderY = minBorderX;
-        const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
-        const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
-
-        vector<cv::KeyPoint> vToDistributeKeys;
-        vToDistributeKeys.reserve(nfeatures*10);
-
-        const float width = (maxBorderX-minBorderX);
-        const float height = (maxBorderY-minBorderY);
+        const int begin = i>0 ? vColumnStarts[i-1] : 0;
+        if(vColumnStarts[i]==begin)
+            continue;
+        vNodes.push_back({begin, vColumnStarts[i],
+                          (int)(hX*static_cast<float>(i)), 0, (int)(hX*static_cast<float>(i+1)), maxY-minY});
+    }
 
-        const int nCols = width/W;
-        const int nRows = height/W;
-        const int wCell = ceil(width/nCols);
-        const int hCell = ceil(height/nRows);
+    FlatExtractorNode children[4];
+    bool bFinish = false;
+    while(!bFinish)
+    {
+        const int prevSize = vNodes.size();
 
-        for(int i=0; i<nRows; i++)
+        // Subdivide every node with more than one point
+        vNextNodes.clear();
+        vToExpand.clear();
+        for(const FlatExtractorNode& node : vNodes)
         {
-            const float iniY =minBorderY+i*hCell;
-            float maxY = iniY+hCell+6;
-
-            if(iniY>=maxBorderY-3)
+            if(node.end-node.begin==1)
+            {
+                vNextNodes.push_back(node);
                 continue;
-            if(maxY>maxBorderY)
-                maxY = maxBorderY;
+            }
 
-            for(int j=0; j<nCols; j++)
+            DivideFlatNode(node, vToDistributeKeys, vIndices, children);
+            for(const FlatExtractorNode& child : children)
             {
-                const float iniX =minBorderX+j*wCell;
-                float maxX = iniX+wCell+6;
-                if(iniX>=maxBorderX-6)
+                const int nChildKeys = child.end-child.begin;
+                if(nChildKeys==0)
                     continue;
-                if(maxX>maxBorderX)
-                    maxX = maxBorderX;
+                if(nChildKeys>1)
+                    vToExpand.push_back(make_pair(nChildKeys, (int)vNextNodes.size()));
+                vNextNodes.push_back(child);
+            }
+        }
+        vNodes.swap(vNextNodes);
 
-                vector<cv::KeyPoint> vKeysCell;
-                FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                     vKeysCell,iniThFAST,true);
+        // Finish if there are more nodes than required features
+        // or all nodes contain just one point
+        if((int)vNodes.size()>=N || (int)vNodes.size()==prevSize)
+        {
+            bFinish = true;
+        }
+        else if(((int)vNodes.size()+(int)vToExpand.size()*3)>N)
+        {
+            // Subdivide the largest nodes first until there are enough. A divided node is
+            // replaced by its first non-empty child, the other children are appended.
+            while(!bFinish)
+            {
+                const int prevSizeFinal = vNodes.size();
 
-                if(vKeysCell.empty())
+                vPrevToExpand.swap(vToExpand);
+                vToExpand.clear();
+                sort(vPrevToExpand.begin(), vPrevToExpand.end());
+                for(int j=vPrevToExpand.size()-1; j>=0; j--)
                 {
-                    FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                         vKeysCell,minThFAST,true);
-                }
+                    const int iNode = vPrevToExpand[j].second;
+                    DivideFlatNode(vNodes[iNode], vToDistributeKeys, vIndices, children);
 
-                if(!vKeysCell.empty())
-                {
-                    for(vector<cv::KeyPoint>::iterator vit=vKeysCell.begin(); vit!=vKeysCell.end();vit++)
+                    bool bReplaced = false;
+                    for(const FlatExtractorNode& child : children)
                     {
-                        (*vit).pt.x+=j*wCell;
-                        (*vit).pt.y+=i*hCell;
-                        vToDistributeKeys.push_back(*vit);
+                        const int nChildKeys = child.end-child.begin;
+                        if(nChildKeys==0)
+                            continue;
+                        int iChild = iNode;
+                        if(bReplaced)
+                        {
+                            iChild = vNodes.size();
+                            vNodes.push_back(child);
+                        }
+                        else
+                        {
+                            vNodes[iNode] = child;
+                            bReplaced = true;
+                        }
+                        if(nChildKeys>1)
+                            vToExpand.push_back(make_pair(nChildKeys, iChild));
                     }
+
+                    if((int)vNodes.size()>=N)
+                        break;
                 }
 
+                if((int)vNodes.size()>=N || (int)vNodes.size()==prevSizeFinal)
+                    bFinish = true;
             }
         }
+    }
+
+    // Retain the best point in each node
+    vector<cv::KeyPoint> vResultKeys;
+    vResultKeys.reserve(vNodes.size());
+    for(const FlatExtractorNode& node : vNodes)
+    {
+        int iBest = vIndices[node.begin];
+        for(int k=node.begin+1; k<node.end; k++)
+        {
+            if(vToDistributeKeys[vIndices[k]].response>vToDistributeKeys[iBest].response)
+                iBest = vIndices[k];
+        }
+        vResultKeys.push_back(vToDistributeKeys[iBest]);
+    }
+
+    return vResultKeys;
+}
+
+// Whether the level region [x0, x1) x [y0, y1) covers a non zero pixel of the image mask
+static bool maskCoversRegion(const Mat& mask, int x0, int x1, int y0, int y1, float scale)
+{
+    const int mx0 = std::max(cvFloor(x0*scale), 0);
+    const int my0 = std::max(cvFloor(y0*scale), 0);
+    const int mx1 = std::min(cvCeil(x1*scale), mask.cols);
+    const int my1 = std::min(cvCeil(y1*scale), mask.rows);
+    if (mx0 >= mx1 || my0 >= my1)
+        return false;
+    return countNonZero(mask(Rect(mx0, my0, mx1-mx0, my1-my0))) > 0;
+}
+
+void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoints, const Mat& mask)
+{
+    allKeypoints.resize(nlevels);
+
+    const float W = 30;
+
+    struct LevelGrid
+    {
+        int minBorderX, minBorderY, maxBorderX, maxBorderY;
+        int nCols, nRows, wCell, hCell;
+        int firstRow;
+    };
+
+    vector<LevelGrid> vGrids(nlevels);
+    int nTotalRows = 0;
+    for (int level = 0; level < nlevels; ++level)
+    {
+        LevelGrid& grid = vGrids[level];
+        grid.minBorderX = EDGE_THRESHOLD-3;
+        grid.minBorderY = grid.minBorderX;
+        grid.maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
+        grid.maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
+
+        const float width = (grid.maxBorderX-grid.minBorderX);
+        const float height = (grid.maxBorderY-grid.minBorderY);
+
+        grid.nCols = width/W;
+        grid.nRows = height/W;
+        grid.wCell = ceil(width/grid.nCols);
+        grid.hCell = ceil(height/grid.nRows);
+        grid.firstRow = nTotalRows;
+        nTotalRows += grid.nRows;
+
+        if ((int)mvCellThState[level].size() != grid.nRows*grid.nCols)
+            mvCellThState[level].assign(grid.nRows*grid.nCols, 0);
+    }
+
+    // FAST on every cell row of every level. Rows are independent tasks, and the
+    // keypoints of a row are ordered by cell, like running FAST cell by cell.
+    vector<vector<KeyPoint> > vRowKeys(nTotalRows);
+    runTasks(mpThreadPool, nTotalRows, [&](int task)
+    {
+        int level = nlevels-1;
+        while (vGrids[level].firstRow > task)
+            level--;
+        const LevelGrid& grid = vGrids[level];
+        const int i = task - grid.firstRow;
+        vector<KeyPoint>& vKeysRow = vRowKeys[task];
+
+        const int iniY =grid.minBorderY+i*grid.hCell;
+        int maxY = iniY+grid.hCell+6;
+
+        if(iniY>=grid.maxBorderY-3)
+            return;
+        if(maxY>grid.maxBorderY)
+            maxY = grid.maxBorderY;
+
+        // Every cell is scored at the threshold it starts with, which is minThFAST
+        // only for cells that needed it on the previous frames
+        const Mat& image = mvImagePyramid[level];
+        Mat& scores = mvFastScores[level];
+        uchar* cellThState = &mvCellThState[level][i*grid.nCols];
+        int pixel[FAST_RING + FAST_ARC];
+        makeFastOffsets(pixel, (int)image.step);
+        const int thIni = std::min(std::max(iniThFAST, 0), 255);
+        const int thMin = std::min(std::max(minThFAST, 0), 255);
+
+        const Point2i origin(grid.minBorderX, grid.minBorderY);
+        for(int j=0; j<grid.nCols; j++)
+        {
+            const int iniX =grid.minBorderX+j*grid.wCell;
+            int maxX = iniX+grid.wCell+6;
+            if(iniX>=grid.maxBorderX-6)
+                continue;
+            if(maxX>grid.maxBorderX)
+                maxX = grid.maxBorderX;
+
+            if(!mask.empty() && !maskCoversRegion(mask, iniX+3, maxX-3, iniY+3, maxY-3, mvScaleFactor[level]))
+                continue;
+
+            uchar& state = cellThState[j];
+            const bool startAtMin = state > 0;
+            const int th = startAtMin ? thMin : thIni;
+            for (int y = iniY+3; y < maxY-3; y++)
+                computeFastScores(image.ptr<uchar>(y), scores.ptr<uchar>(y), iniX+3, maxX-3, pixel, th);
+
+            const size_t nKeys = vKeysRow.size();
+            detectFastCell(scores, iniX+3, maxX-3, iniY+3, maxY-3, th, origin, vKeysRow);
+
+            if (!startAtMin)
+            {
+                if(vKeysRow.size() == nKeys)
+                {
+                    for (int y = iniY+3; y < maxY-3; y++)
+                        computeFastScores(image.ptr<uchar>(y), scores.ptr<uchar>(y), iniX+3, maxX-3, pixel, thMin);
+                    detectFastCell(scores, iniX+3, maxX-3, iniY+3, maxY-3, thMin, origin, vKeysRow);
+                    if (nThHysteresis > 0)
+                        state = 1;
+                }
+                continue;
+            }
+
+            // Go back to iniThFAST once the cell has had corners above it for
+            // nThHysteresis frames in a row
+            bool iniProductive = false;
+            for (size_t k = nKeys; k < vKeysRow.size() && !iniProductive; k++)
+                iniProductive = vKeysRow[k].response >= thIni;
+            if (!iniProductive)
+                state = 1;
+            else if (++state > nThHysteresis)
+                state = 0;
+        }
+    });
+
+    // Distribution and orientation are independent per level
+    runTasks(mpThreadPool, nlevels, [&](int level)
+    {
+        const LevelGrid& grid = vGrids[level];
+
+        vector<cv::KeyPoint> vToDistributeKeys;
+        vToDistributeKeys.reserve(nfeatures*10);
+        for (int i = 0; i < grid.nRows; i++)
+        {
+            const vector<KeyPoint>& vKeysRow = vRowKeys[grid.firstRow + i];
+            vToDistributeKeys.insert(vToDistributeKeys.end(), vKeysRow.begin(), vKeysRow.end());
+        }
+
+        // Cells partly inside the mask still have keypoints outside it
+        if (!mask.empty())
+        {
+            const float scale = mvScaleFactor[level];
+            vToDistributeKeys.erase(std::remove_if(vToDistributeKeys.begin(), vToDistributeKeys.end(),
+                [&](const KeyPoint& kp)
+                {
+                    const int x = std::min(cvRound((kp.pt.x+grid.minBorderX)*scale), mask.cols-1);
+                    const int y = std::min(cvRound((kp.pt.y+grid.minBorderY)*scale), mask.rows-1);
+                    return mask.at<uchar>(y, x) == 0;
+                }), vToDistributeKeys.end());
+        }
 
         vector<KeyPoint> & keypoints = allKeypoints[level];
         keypoints.reserve(nfeatures);
 
-        keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
-                                      minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
+        keypoints = bFlatOctTree ?
+            DistributeOctTreeFlat(vToDistributeKeys, grid.minBorderX, grid.maxBorderX,
+                                  grid.minBorderY, grid.maxBorderY,mnFeaturesPerLevel[level], level) :
+            DistributeOctTree(vToDistributeKeys, grid.minBorderX, grid.maxBorderX,
+                                      grid.minBorderY, grid.maxBorderY,mnFeaturesPerLevel[level], level);
 
         const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
 
@@ -847,16 +1436,16 @@ void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoin
         const int nkps = keypoints.size();
         for(int i=0; i<nkps ; i++)
         {
-            keypoints[i].pt.x+=minBorderX;
-            keypoints[i].pt.y+=minBorderY;
+            keypoints[i].pt.x+=grid.minBorderX;
+            keypoints[i].pt.y+=grid.minBorderY;
             keypoints[i].octave=level;
             keypoints[i].size = scaledPatchSize;
         }
-    }
 
-    // compute orientations
-    for (int level = 0; level < nlevels; ++level)
-        computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
+        // compute orientations
+        computeOrientation(mvImagePyramid[level], keypoints, umax, mvOrientWeightsU, mvOrientWeightsV,
+                           nAngleBins, mvKeyPointBins[level]);
+    });
 }
 
 void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allKeypoints)
@@ -1035,7 +1624,8 @@ void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allK
 
     // and compute orientations
     for (int level = 0; level < nlevels; ++level)
-        computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
+        computeOrientation(mvImagePyramid[level], allKeypoints[level], umax, mvOrientWeightsU, mvOrientWeightsV,
+                           nAngleBins, mvKeyPointBins[level]);
 }
 
 static void computeDescriptors(const Mat& image, vector<KeyPoint>& keypoints, Mat& descriptors,
@@ -1047,6 +1637,19 @@ static void computeDescriptors(const Mat& image, vector<KeyPoint>& keypoints, Ma
         computeOrbDescriptor(keypoints[i], image, &pattern[0], descriptors.ptr((int)i));
 }
 
+static void computeDescriptorsBinned(const Mat& image, vector<KeyPoint>& keypoints, const vector<int>& bins,
+                                     Mat& descriptors, const vector<int>& rotatedPatternX,
+                                     const vector<int>& rotatedPatternY)
+{
+    const int npoints = 512;
+    for (size_t i = 0; i < keypoints.size(); i++)
+    {
+        const int bin = bins[i];
+        computeOrbDescriptorBinned(keypoints[i], image, &rotatedPatternX[bin*npoints],
+                                   &rotatedPatternY[bin*npoints], descriptors.ptr((int)i));
+    }
+}
+
 void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPoint>& _keypoints,
                       OutputArray _descriptors)
 { 
@@ -1056,10 +1659,13 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
     Mat image = _image.getMat();
     assert(image.type() == CV_8UC1 );
 
+    Mat mask = _mask.getMat();
+    assert(mask.empty() || (mask.type() == CV_8UC1 && mask.size() == image.size()));
+
     ComputePyramid(image);
 
     vector < vector<KeyPoint> > allKeypoints; // vector<vector<KeyPoint>>
-    ComputeKeyPointsOctTree(allKeypoints);
+    ComputeKeyPointsOctTree(allKeypoints, mask);
     //ComputeKeyPointsOld(allKeypoints);
 
     Mat descriptors;
@@ -1078,24 +1684,30 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
     _keypoints.clear();
     _keypoints.reserve(nkeypoints);
 
-    int offset = 0;
-    for (int level = 0; level < nlevels; ++level)
+    vector<int> vLevelOffsets(nlevels, 0);
+    for (int level = 1; level < nlevels; ++level)
+        vLevelOffsets[level] = vLevelOffsets[level-1] + (int)allKeypoints[level-1].size();
+
+    // Descriptors of a level are written to their own descriptor rows
+    runTasks(mpThreadPool, nlevels, [&](int level)
     {
         vector<KeyPoint>& keypoints = allKeypoints[level];
         int nkeypointsLevel = (int)keypoints.size();
 
         if(nkeypointsLevel==0)
-            continue;
+            return;
 
-        // preprocess the resized image 对图像进行高斯模糊
-        Mat workingMat = mvImagePyramid[level].clone();
-        GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);
+        // The level was blurred along with the pyramid 对图像进行高斯模糊
+        Mat& workingMat = mvBlurredPyramid[level];
 
         // Compute the descriptors 计算描述子
+        int offset = vLevelOffsets[level];
         Mat desc = descriptors.rowRange(offset, offset + nkeypointsLevel);
-        computeDescriptors(workingMat, keypoints, desc, pattern);
-
-        offset += nkeypointsLevel;
+        if (nAngleBins > 0)
+            computeDescriptorsBinned(workingMat, keypoints, mvKeyPointBins[level], desc,
+                                     mvRotatedPatternX, mvRotatedPatternY);
+        else
+            computeDescriptors(workingMat, keypoints, desc, pattern);
 
         // Scale keypoint coordinates
         if (level != 0)
@@ -1105,26 +1717,162 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
                  keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
                 keypoint->pt *= scale;
         }
-        // And add the keypoints to the output
-        _keypoints.insert(_keypoints.end(), keypoints.begin(), keypoints.end());
+    });
+
+    // And add the keypoints to the output
+    for (int level = 0; level < nlevels; ++level)
+        _keypoints.insert(_keypoints.end(), allKeypoints[level].begin(), allKeypoints[level].end());
+}
+
+// 7x7, sigma 2 Gaussian used to smooth the levels before computing descriptors.
+// The kernel is quantized to 8 fractional bits with error diffusion, the same way
+// OpenCV's bit-exact 8 bit GaussianBlur does, so the result matches GaussianBlur.
+const int BLUR_RADIUS = 3;
+const int BLUR_SIZE = 2*BLUR_RADIUS + 1;
+
+static const vector<ushort>& getBlurKernel()
+{
+    static const vector<ushort> kernel = []
+    {
+        Mat gaussian = getGaussianKernel(BLUR_SIZE, 2, CV_64F);
+        vector<ushort> k(BLUR_SIZE);
+        double err = 0;
+        int sum = 0;
+        for (int i = 0; i < BLUR_RADIUS; i++)
+        {
+            double v = gaussian.at<double>(i)*256 + err;
+            int v0 = cvRound(v);
+            err = v - v0;
+            k[i] = k[BLUR_SIZE-1-i] = (ushort)v0;
+            sum += v0;
+        }
+        k[BLUR_RADIUS] = (ushort)(256 - 2*sum);
+        return k;
+    }();
+    return kernel;
+}
+
+// Horizontal pass of one row, 8 fractional bits. src points to the first pixel of the
+// row and must be readable BLUR_RADIUS pixels on either side.
+static void blurRow(const uchar* src, ushort* dst, int width, const ushort* k)
+{
+    int x = 0;
+#if ORB_SIMD128
+    const v_uint16x8 k0 = v_setall_u16(k[0]), k1 = v_setall_u16(k[1]),
+                     k2 = v_setall_u16(k[2]), k3 = v_setall_u16(k[3]);
+    for (; x <= width - 8; x += 8)
+    {
+        const uchar* p = src + x;
+        v_uint16x8 sum = v_mul_wrap(v_load_expand(p), k3);
+        sum = v_add_wrap(sum, v_mul_wrap(v_add_wrap(v_load_expand(p - 1), v_load_expand(p + 1)), k2));
+        sum = v_add_wrap(sum, v_mul_wrap(v_add_wrap(v_load_expand(p - 2), v_load_expand(p + 2)), k1));
+        sum = v_add_wrap(sum, v_mul_wrap(v_add_wrap(v_load_expand(p - 3), v_load_expand(p + 3)), k0));
+        v_store(dst + x, sum);
+    }
+#endif
+    for (; x < width; x++)
+    {
+        const uchar* p = src + x;
+        dst[x] = (ushort)(p[0]*k[3] + (p[-1] + p[1])*k[2] + (p[-2] + p[2])*k[1] + (p[-3] + p[3])*k[0]);
     }
 }
 
-void ORBextractor::ComputePyramid(cv::Mat& image)
+// Vertical pass over BLUR_SIZE horizontally filtered rows, rounded back to 8 bit
+static void blurColumns(const ushort* const* rows, uchar* dst, int width, const ushort* k)
+{
+    int x = 0;
+#if ORB_SIMD128
+    const v_uint32x4 k0 = v_setall_u32(k[0]), k1 = v_setall_u32(k[1]),
+                     k2 = v_setall_u32(k[2]), k3 = v_setall_u32(k[3]);
+    for (; x <= width - 8; x += 8)
+    {
+        v_uint32x4 lo, hi, sumLo, sumHi;
+        v_expand(v_load(rows[3] + x), lo, hi);
+        sumLo = lo*k3;
+        sumHi = hi*k3;
+        v_uint32x4 lo1, hi1;
+        v_expand(v_load(rows[2] + x), lo, hi);
+        v_expand(v_load(rows[4] + x), lo1, hi1);
+        sumLo += (lo + lo1)*k2;
+        sumHi += (hi + hi1)*k2;
+        v_expand(v_load(rows[1] + x), lo, hi);
+        v_expand(v_load(rows[5] + x), lo1, hi1);
+        sumLo += (lo + lo1)*k1;
+        sumHi += (hi + hi1)*k1;
+        v_expand(v_load(rows[0] + x), lo, hi);
+        v_expand(v_load(rows[6] + x), lo1, hi1);
+        sumLo += (lo + lo1)*k0;
+        sumHi += (hi + hi1)*k0;
+        v_pack_store(dst + x, v_rshr_pack<16>(sumLo, sumHi));
+    }
+#endif
+    for (; x < width; x++)
+    {
+        unsigned sum = rows[3][x]*k[3] + (rows[2][x] + rows[4][x])*k[2] +
+                       (rows[1][x] + rows[5][x])*k[1] + (rows[0][x] + rows[6][x])*k[0];
+        dst[x] = (uchar)((sum + (1u << 15)) >> 16);
+    }
+}
+
+// Blurs a pyramid level into dst. The level is a view into its bordered buffer, whose
+// border already holds the BORDER_REFLECT_101 pixels, so no border handling is needed.
+// rowBuffer holds BLUR_SIZE horizontally filtered rows, used as a ring.
+static void blurLevel(const Mat& level, Mat& dst, vector<ushort>& rowBuffer)
+{
+    const vector<ushort>& k = getBlurKernel();
+    const int width = level.cols;
+    const int height = level.rows;
+    rowBuffer.resize(BLUR_SIZE*width);
+
+    const ushort* rows[BLUR_SIZE];
+    for (int y = -BLUR_RADIUS; y < BLUR_RADIUS; y++)
+        blurRow(level.ptr<uchar>(0) + y*level.step, &rowBuffer[(y + BLUR_SIZE)%BLUR_SIZE*width], width, &k[0]);
+
+    for (int y = 0; y < height; y++)
+    {
+        const int yNew = y + BLUR_RADIUS;
+        blurRow(level.ptr<uchar>(0) + yNew*level.step, &rowBuffer[yNew%BLUR_SIZE*width], width, &k[0]);
+        for (int i = 0; i < BLUR_SIZE; i++)
+            rows[i] = &rowBuffer[(y - BLUR_RADIUS + i + BLUR_SIZE)%BLUR_SIZE*width];
+        blurColumns(rows, dst.ptr<uchar>(y), width, &k[0]);
+    }
+}
+
+void ORBextractor::AllocatePyramid(const cv::Size& imageSize)
 {
+    mvPyramidBuffers.resize(nlevels);
+    mvBlurredPyramid.resize(nlevels);
+    mvFastScores.resize(nlevels);
     for (int level = 0; level < nlevels; ++level)
     {
         float scale = mvInvScaleFactor[level]; 
-        Size sz(cvRound((float)image.cols*scale), cvRound((float)image.rows*scale));
+        Size sz(cvRound((float)imageSize.width*scale), cvRound((float)imageSize.height*scale));
         Size wholeSize(sz.width + EDGE_THRESHOLD*2, sz.height + EDGE_THRESHOLD*2);
-        Mat masktemp;
-        Mat temp(wholeSize, image.type());
-        mvImagePyramid[level] = temp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
+        mvPyramidBuffers[level].create(wholeSize, CV_8UC1);
+        mvImagePyramid[level] = mvPyramidBuffers[level](Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
+        mvBlurredPyramid[level].create(sz, CV_8UC1);
+        mvFastScores[level].create(sz, CV_8UC1);
+    }
+    mvBlurRowBuffers.resize(nlevels);
+    mPyramidImageSize = imageSize;
+}
+
+void ORBextractor::ComputePyramid(cv::Mat& image)
+{
+    if (image.size() != mPyramidImageSize)
+        AllocatePyramid(image.size());
+
+    // Every level is blurred right after it is built, while it is still in cache.
+    // With a thread pool the blur overlaps with building the next level.
+    vector<future<void> > vBlurs;
+    for (int level = 0; level < nlevels; ++level)
+    {
+        Mat& temp = mvPyramidBuffers[level];
 
         // Compute the resized image
         if( level != 0 )
         {
-            resize(mvImagePyramid[level-1], mvImagePyramid[level], sz, 0, 0, cv::INTER_LINEAR);
+            resize(mvImagePyramid[level-1], mvImagePyramid[level], mvImagePyramid[level].size(), 0, 0, cv::INTER_LINEAR);
 
             copyMakeBorder(mvImagePyramid[level], temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
                            BORDER_REFLECT_101+BORDER_ISOLATED);            
@@ -1132,10 +1880,21 @@ void ORBextractor::ComputePyramid(cv::Mat& image)
         else
         {
             copyMakeBorder(image, temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
-                           BORDER_REFLECT_101);            
+                           BORDER_REFLECT_101+BORDER_ISOLATED);            
         }
+
+        auto blur = [this, level]
+        {
+            blurLevel(mvImagePyramid[level], mvBlurredPyramid[level], mvBlurRowBuffers[level]);
+        };
+        if (mpThreadPool)
+            vBlurs.push_back(mpThreadPool->submit(blur));
+        else
+            blur();
     }
 
+    for (auto& b : vBlurs)
+        b.get();
 }
 
 #endif /* __ORB_EXTRACTOR_HPP__ */
\ No newline at end of file
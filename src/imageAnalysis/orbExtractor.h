@@ -67,6 +67,7 @@
 #include <vector>
 #include <list>
 #include "opencv2/opencv.hpp"
+#include "../utils/threadPool.hpp"
 
 
 class ExtractorNode
@@ -82,20 +83,38 @@ public:
     bool bNoMore;
 };
 
+// Node of the flat quadtree, the range [begin, end) of the index array and the node bounds
+struct FlatExtractorNode
+{
+    int begin, end;
+    int minX, minY, maxX, maxY;
+};
+
 class ORBextractor
 {
 public:
     
     enum {HARRIS_SCORE=0, FAST_SCORE=1 };
 
+    // nAngleBins > 0 quantizes keypoint angles into that many bins and uses the
+    // pattern pre-rotated for each bin. 0 rotates the pattern for every keypoint.
+    // nThHysteresis > 0 lets a FAST cell which needed minThFAST start there on the next
+    // frames, until it has had corners above iniThFAST for nThHysteresis frames in a row.
+    // bFlatOctTree distributes keypoints with a quadtree partitioning an index array in
+    // place. false uses the list based octree of ORB-SLAM2.
+    // With a threadPool, pyramid levels and FAST cell rows are processed in parallel.
+    // The output is identical to the serial path.
     ORBextractor(int nfeatures, float scaleFactor, int nlevels,
-                 int iniThFAST, int minThFAST);
+                 int iniThFAST, int minThFAST, int nAngleBins = 30,
+                 int nThHysteresis = 0, bool bFlatOctTree = true,
+                 ThreadPool* threadPool = nullptr);
 
     ~ORBextractor(){}
 
     // Compute the ORB features and descriptors on an image.
     // ORB are dispersed on the image using an octree.
-    // Mask is ignored in the current implementation.
+    // An optional CV_8UC1 mask of the image size keeps only keypoints on its non zero
+    // pixels. FAST cells of a level which cover no such pixel are not detected at all.
     void operator()( cv::InputArray image, cv::InputArray mask,
       std::vector<cv::KeyPoint>& keypoints,
       cv::OutputArray descriptors);
@@ -126,10 +145,39 @@ public:
 
 protected:
 
+    // Bordered level buffers the pyramid levels point into, and the blurred levels used
+    // for descriptors. Allocated once per input resolution and filled in place after that.
+    // The blur is computed while building the pyramid, using per level row buffers.
+    std::vector<cv::Mat> mvPyramidBuffers;
+    std::vector<cv::Mat> mvBlurredPyramid;
+    std::vector<std::vector<ushort> > mvBlurRowBuffers;
+
+    // FAST score of every level pixel, 0 where it is not a corner
+    std::vector<cv::Mat> mvFastScores;
+
+    // Per level and cell, 0 when FAST starts at iniThFAST. Otherwise it starts at
+    // minThFAST, and the value is 1 + the frames in a row the cell had corners above iniThFAST.
+    std::vector<std::vector<uchar> > mvCellThState;
+    cv::Size mPyramidImageSize;
+
+    // Per level buffers of the flat quadtree, kept across frames
+    struct OctTreeBuffers
+    {
+        std::vector<int> vIndices;
+        std::vector<int> vColumnStarts;
+        std::vector<FlatExtractorNode> vNodes, vNextNodes;
+        std::vector<std::pair<int,int> > vToExpand, vPrevToExpand;
+    };
+    std::vector<OctTreeBuffers> mvOctTreeBuffers;
+
+    void AllocatePyramid(const cv::Size& imageSize);
+
     void ComputePyramid(cv::Mat& image);
-    void ComputeKeyPointsOctTree(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);    
+    void ComputeKeyPointsOctTree(std::vector<std::vector<cv::KeyPoint> >& allKeypoints, const cv::Mat& mask);
     std::vector<cv::KeyPoint> DistributeOctTree(const std::vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
                                            const int &maxX, const int &minY, const int &maxY, const int &nFeatures, const int &level);
+    std::vector<cv::KeyPoint> DistributeOctTreeFlat(const std::vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
+                                           const int &maxX, const int &minY, const int &maxY, const int &nFeatures, const int &level);
 
     void ComputeKeyPointsOld(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);
     std::vector<cv::Point> pattern;
@@ -139,11 +187,30 @@ protected:
     int nlevels;
     int iniThFAST;
     int minThFAST;
+    int nAngleBins;
+    int nThHysteresis;
+    bool bFlatOctTree;
+
+    // Pattern rotated for every angle bin, nAngleBins x 512 offsets. The first 256
+    // entries of a bin are the first points of the comparisons, the next 256 the second.
+    std::vector<int> mvRotatedPatternX;
+    std::vector<int> mvRotatedPatternY;
+
+    // Not owned, may be shared with other extractors
+    ThreadPool* mpThreadPool;
 
     std::vector<int> mnFeaturesPerLevel;
 
     std::vector<int> umax;
 
+    // Orientation weights of the circular patch rows v = 0..15, 32 lanes for u = -15..16.
+    // mvOrientWeightsU holds u and mvOrientWeightsV holds v where |u| <= umax[v], 0 elsewhere.
+    std::vector<short> mvOrientWeightsU;
+    std::vector<short> mvOrientWeightsV;
+
+    // Pattern angle bin of every keypoint of a level, written with the orientation
+    std::vector<std::vector<int> > mvKeyPointBins;
+
     std::vector<float> mvScaleFactor;
     std::vector<float> mvInvScaleFactor;    
     std::vector<float> mvLevelSigma2;
@@ -40,14 +40,14 @@ class BaHelper {
     protected:
         SlamConfig& _slamCfg;
         SP<Frame> _currFrame;
-        SP<LandmarkTransMap> _landmarkEstimateMap = make_shared<LandmarkTransMap>();
-        SP<FramePoseMap> _framePoseMap = make_shared<FramePoseMap>();
         SP<EstimateValidator> _estimateValidator;
         SP<FrameManager> _fm;
         SP<LandmarkManager> _lm;
         SP<BaHelperOutput> _output;
         Mat _cameraMatrix;
         Mat _distCoeffs;
+        //Scratch sets and maps and the output go on it, on the heap when null
+        FrameArena* _arena;
         SP<BA> _ba;
 
         SP<BA> generate_ba(int iterations) 
@@ -71,24 +71,21 @@ class BaHelper {
             SP<FrameSet> fixedFrames,
             int threshold)
         {
-            map<SP<Frame>, set<SP<Landmark>>> fLs;
-            map<SP<Landmark>, set<SP<Frame>>> lFs;
+            SlotMap<Frame, LandmarkSet> fLs(_arena);
             for (auto l : *landmarkSet) {
                 for (auto fp : l->fps) {
                     auto f = fp->frame;
-                    if (frameSet->count(f) > 0) {
-                        fLs[f].insert(l);
-                        lFs[l].insert(f);
-                    }
+                    if (frameSet->count(f) > 0) fLs[f].insert(l);
                 }
             }
-            auto spFrameRank = make_shared<FrameRank>();
-            LandmarkSet landmarksCovered;
+            auto spFrameRank = arena_shared<FrameRank>(_arena, _arena);
+            LandmarkSet landmarksCovered(_arena);
             int rank = 0;
             for (auto f : *fixedFrames) {
                 if (frameSet->count(f) > 0) {
                     (*spFrameRank)[f] = rank;
-                    landmarksCovered.insert(fLs[f].begin(), fLs[f].end());
+                    auto& ls = fLs[f];
+                    landmarksCovered.insert(ls.begin(), ls.end());
                 }
             }
             for (auto l : *fixedLandmarks) {
@@ -99,7 +96,7 @@ class BaHelper {
 
             while (true) {
                 rank++;
-                FrameSet newFrames;
+                FrameSet newFrames(_arena);
                 for (auto f : *frameSet) {
                     if (spFrameRank->count(f) > 0) continue;
                     int count = 0;
@@ -118,7 +115,8 @@ class BaHelper {
                 if (newFrames.size() == 0) break;
 
                 for (auto f : newFrames) {
-                    landmarksCovered.insert(fLs[f].begin(), fLs[f].end());
+                    auto& ls = fLs[f];
+                    landmarksCovered.insert(ls.begin(), ls.end());
                 }
             }
 
@@ -137,9 +135,10 @@ class BaHelper {
                 SP<LandmarkTransMap> landmarkTransMap = nullptr, 
                 SP<FramePoseMap> framePoseMap = nullptr) 
         {
-            LandmarkSet landmarksToAdd;
-            FrameSet framesToAdd;
-            set<pair<SP<FramePoint>, SP<Landmark>>> fpToAdd;
+            LandmarkSet landmarksToAdd(_arena);
+            FrameSet framesToAdd(_arena);
+            //Every (point, landmark) pair is visited once, the landmarks are unique
+            FramePointLandmarkPairVec fpToAdd(_arena);
             for (auto const& landmark: *landmarkSet) {
                 //If Landmark is already added, skip it.
                 if (ba->landmarks.count(landmark)) continue;
@@ -160,7 +159,7 @@ class BaHelper {
                         if (frameSet->count(frame) == 0) continue;
 
                         framesToAdd.insert(frame);
-                        fpToAdd.insert(make_pair(fp, landmark));
+                        fpToAdd.push_back(make_pair(fp, landmark));
                     }
                 } else {//Landmark is fixed. So it needs to be added only if 
                         //there are unfixed frames attached to it
@@ -175,7 +174,7 @@ class BaHelper {
                         //it gets added only if there is at least non-fixed frame
                         landmarksToAdd.insert(landmark);
                         framesToAdd.insert(fp->frame);
-                        fpToAdd.insert(make_pair(fp, landmark));
+                        fpToAdd.push_back(make_pair(fp, landmark));
                     }
                 }
             }
@@ -240,7 +239,8 @@ class BaHelper {
             SP<FrameManager> fm, 
             SP<LandmarkManager> lm,
             const Mat& cameraMatrix, 
-            const Mat& distCoeffs
+            const Mat& distCoeffs,
+            FrameArena* arena = nullptr
         ) : _slamCfg(slamCfg), 
             _currFrame(currFrame), 
             _estimateValidator(make_shared<EstimateValidator>(
@@ -248,12 +248,14 @@ class BaHelper {
                 lm, 
                 fm,
                 cameraMatrix, 
-                distCoeffs)
+                distCoeffs,
+                arena)
             ), 
             _fm(fm), 
             _lm(lm), 
             _cameraMatrix(cameraMatrix), 
-            _distCoeffs(distCoeffs) 
+            _distCoeffs(distCoeffs),
+            _arena(arena) 
         {}
 
 
@@ -287,13 +289,13 @@ class BaHelper {
                 SP<LandmarkTransMap> landmarkTransMap = nullptr,
                 SP<FramePoseMap> framePoseMap = nullptr) 
         {
-            if (fixedLandmarks == nullptr) fixedLandmarks = make_shared<LandmarkSet>();
-            if (fixedFrames == nullptr) fixedFrames = make_shared<FrameSet>();
+            if (fixedLandmarks == nullptr) fixedLandmarks = arena_shared<LandmarkSet>(_arena, _arena);
+            if (fixedFrames == nullptr) fixedFrames = arena_shared<FrameSet>(_arena, _arena);
 
             auto startTime = Timer::time();
 
             //Clean up frameSet
-            auto frameSet = make_shared<FrameSet>();
+            auto frameSet = arena_shared<FrameSet>(_arena, _arena);
             for (auto l : *landmarkSet) {
                 for (auto fp : l->fps) {
                     if (frameSetArg->count(fp->frame)) 
@@ -330,7 +332,7 @@ class BaHelper {
             auto optimizeTime = Timer::diff(startTime);
             startTime = Timer::time();
 
-            auto [landmarkTransMap2, framePoseMap2] = _ba->get_estimates();
+            auto [landmarkTransMap2, framePoseMap2] = _ba->get_estimates(_arena);
             if (landmarkTransMap) {
                 for (auto& [l, trans] : *landmarkTransMap) {
                     if (landmarkTransMap2->count(l) == 0)
@@ -340,7 +342,7 @@ class BaHelper {
             if (framePoseMap) {
                 for (auto& [f, pose] : *framePoseMap) {
                     if (framePoseMap2->count(f) == 0)
-                        (*framePoseMap2)[f] = make_shared<Pose>(pose);
+                        (*framePoseMap2)[f] = arena_shared<Pose>(_arena, pose);
                 }
             }
 
@@ -360,14 +362,15 @@ class BaHelper {
                         framePoseMap2,
                         validate);
 
-            _output = make_shared<BaHelperOutput>(
+            _output = arena_shared<BaHelperOutput>(_arena,
                     landmarkSet, 
                     frameSet,
                     fixedLandmarks, 
                     fixedFrames,
                     frameRank, 
                     maxRank,
-                    validatorOutput);
+                    validatorOutput,
+                    _arena);
             auto validateTime = Timer::diff(startTime);
             DEBUG_COUT(_currFrame->id<<": BAHelper Time Init "<<initTime<<" Graph "<<graphTime);
             DEBUG_COUT(" Optimize "<<optimizeTime<<" Validate "<<validateTime);
@@ -393,7 +396,7 @@ class BaHelper {
             DEBUG_COUT("BA iterate Final Time "<<Timer::diff(startTimer)<<endl);
 
             startTimer = Timer::time();
-            auto [landmarkTransMap, framePoseMap] = _ba->get_estimates();
+            auto [landmarkTransMap, framePoseMap] = _ba->get_estimates(_arena);
 
             auto validatorOutput = _estimateValidator->validate_estimates(
                         _ba, 
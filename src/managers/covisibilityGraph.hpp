@@ -0,0 +1,121 @@
+/**
+ * @file covisibilityGraph.hpp
+ * @brief Frames linked by the landmarks of the map they share. The weight of the edge
+ * between two frames is the number of landmarks with a point in both. LandmarkManager
+ * updates it whenever a map landmark gains or loses a point, so the work per change is
+ * proportional to the points of that landmark, not to the size of the map.
+ * Key methods:
+ * 1. add_point / remove_point: A point joins or leaves a landmark
+ * 2. neighbours / best_neighbours: Frames sharing landmarks with a frame
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __COVISIBILITY_GRAPH_HPP__
+#define __COVISIBILITY_GRAPH_HPP__
+
+#include <vector>
+#include <algorithm>
+#include "../types/types.hpp"
+
+using namespace std;
+
+class CovisibilityGraph {
+    protected:
+        //Edges with a weight of 0 are removed, so frames that share nothing are released
+        SlotMap<Frame, SlotMap<Frame, int, false>> _edges;
+        const SlotMap<Frame, int, false> _noEdges;
+
+        void update(const SP<Frame>& a, const SP<Frame>& b, int weight) {
+            auto& edges = _edges[a];
+            int& edge = edges[b];
+            edge += weight;
+            assert(edge >= 0);
+            if (edge == 0) {
+                edges.erase(b);
+                if (edges.empty()) _edges.erase(a);
+            }
+        }
+
+    public:
+        void add(const SP<Frame>& a, const SP<Frame>& b, int weight) {
+            if (a == b) return;
+            update(a, b, weight);
+            update(b, a, weight);
+        }
+
+        /**
+         * @brief fp is joining landmark. Call before it is inserted into landmark->fps.
+         *
+         * @param landmark
+         * @param fp
+         */
+        void add_point(const Landmark& landmark, const SP<FramePoint>& fp) {
+            for (auto& other : landmark.fps) {
+                if (other != fp) add(fp->frame, other->frame, 1);
+            }
+        }
+
+        /**
+         * @brief fp is leaving landmark. Call before it is erased from landmark->fps.
+         *
+         * @param landmark
+         * @param fp
+         */
+        void remove_point(const Landmark& landmark, const SP<FramePoint>& fp) {
+            for (auto& other : landmark.fps) {
+                if (other != fp) add(fp->frame, other->frame, -1);
+            }
+        }
+
+        //All points of landmark are leaving it
+        void remove_landmark(const Landmark& landmark) {
+            for (auto it = landmark.fps.begin(); it != landmark.fps.end(); it++) {
+                for (auto other = next(it); other != landmark.fps.end(); other++) {
+                    add((*it)->frame, (*other)->frame, -1);
+                }
+            }
+        }
+
+        int weight(const SP<Frame>& a, const SP<Frame>& b) {
+            auto it = _edges.find(a);
+            if (it == _edges.end()) return 0;
+            auto edge = it->second.find(b);
+            return edge == it->second.end()? 0 : edge->second;
+        }
+
+        //Frames sharing landmarks with frame, with the number of landmarks shared
+        const SlotMap<Frame, int, false>& neighbours(const SP<Frame>& frame) {
+            auto it = _edges.find(frame);
+            return it == _edges.end()? _noEdges : it->second;
+        }
+
+        /**
+         * @brief Neighbours of frame sharing the most landmarks, best first. Ties are
+         * broken by frame id.
+         *
+         * @param frame
+         * @param maxResults
+         * @param minWeight Neighbours sharing fewer landmarks are skipped
+         * @return SP<FrameVec>
+         */
+        SP<FrameVec> best_neighbours(const SP<Frame>& frame, int maxResults, int minWeight = 1) {
+            vector<pair<int, SP<Frame>>> ranked;
+            for (auto& [neighbour, weight] : neighbours(frame)) {
+                if (weight >= minWeight) ranked.push_back(make_pair(weight, neighbour));
+            }
+            int count = min(maxResults, (int)ranked.size());
+            partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(), [](const auto& a, const auto& b) {
+                if (a.first != b.first) return a.first > b.first;
+                return a.second->id < b.second->id;
+            });
+            auto results = make_shared<FrameVec>();
+            for (int i = 0; i < count; i++) results->push_back(ranked[i].second);
+            return results;
+        }
+};
+
+#endif /* __COVISIBILITY_GRAPH_HPP__ */
@@ -7,6 +7,8 @@
  * 2. remove_a_frame: Delete frame. Used to keep the list of frames and memory limited.
  * 3. set_origin_frame: Set origin frame
  * 4. add_keyframe: Add an existing frame to the list of keyframes. Keyframes are the ones mainly used for estimating any new frame.
+ * 5. get_similar_keyframes: Keyframes that look most alike a frame, from the bag of words keyframe database.
+ * 6. get_covisible_keyframes: Keyframes sharing the most landmarks with a frame, from the covisibility graph.
  * @author Parikshit Basu
  * @version 0.1
  * @date 2023-06-07
@@ -22,6 +24,8 @@
 #include <set>
 #include "../types/types.hpp"
 #include "../utils/transformUtils.hpp"
+#include "keyFrameDatabase.hpp"
+#include "covisibilityGraph.hpp"
 
 using namespace std;
 using namespace cv;
@@ -37,12 +41,16 @@ class FrameManager {
         double radScl = 44.0/(360*7);
         SP<FrameSet> _keyFrames = make_shared<FrameSet>();
         SP<FrameSet> _initialKeyFrames = make_shared<FrameSet>();
-        SP<BOWImgDescriptorExtractor> _bowExtractor;
+        //Loaded by set_vocabulary, otherwise trained on the first keyframe for bowCandidates
+        SP<Vocabulary> _vocabulary = make_shared<Vocabulary>();
+        KeyFrameDatabase _keyFrameDb;
         Eigen::Vector3d _currTransSmooth;
         Eigen::Vector3d _currVelSmooth;
 
     public:
         SP<FrameVec> frameList = make_shared<FrameVec>();
+        //Updated by LandmarkManager
+        SP<CovisibilityGraph> covisibility = make_shared<CovisibilityGraph>();
         SP<Frame> originFrame;
         Quaterniond originRotInverse;
         float imgWidth;
@@ -50,6 +58,13 @@ class FrameManager {
     
     protected:
 
+        //Bag of words from the keypoint words when the frame was extracted with the vocabulary
+        void compute_bow(SP<Frame> frame) {
+            auto& kps = frame->kps;
+            if (frame->vocabIndex) frame->bow = _vocabulary->transform(kps.word.data(), kps.size());
+            else frame->bow = _vocabulary->transform(kps.descs);
+        }
+
         Quaterniond get_rotation(double orientation[3]) {
             if (_cfg.disableRotationInput) {
                 Quaterniond w;
@@ -62,76 +77,6 @@ class FrameManager {
             }
         }
 
-        void populate_match_node(MatchNodeVec& matchNodes, FramePointSet& fpsPending, 
-                    int branchSize, int leafSize, SP<Frame> frame) {
-            int maxSize = ((int)fpsPending.size() < leafSize)? (int)fpsPending.size() : branchSize;
-            for (int index = 0; index < maxSize; index++) {
-                auto fp = TransformUtils::pop_random<SP<FramePoint>>(fpsPending);
-                matchNodes.push_back(make_shared<MatchNode>(fp));
-            }
-            if (fpsPending.size() == 0) return;
-
-            map<SP<MatchNode>, FramePointSet> nodeFps;
-            auto descriptorFrames = make_shared<FrameSet>();
-            descriptorFrames->insert(frame);
-            for (auto fp : fpsPending) {
-                float minDistance = -1;
-                SP<MatchNode> minNode;
-                for (auto childNode : matchNodes) {
-                    auto distance = TransformUtils::get_distance(fp, childNode->fp, descriptorFrames);
-                    if (minDistance == -1 || distance < minDistance) {
-                        minDistance = distance;
-                        minNode = childNode;
-                    }
-                }
-                nodeFps[minNode].insert(fp);
-            }
-            for (auto& [node, fps]: nodeFps) {
-                populate_match_node(node->children, fps, branchSize, leafSize, frame);
-            }
-        }
-
-        void populate_match_tree(SP<Frame> frame) {
-            int leafSize = _cfg.leafSize;
-            int branchSize = _cfg.branchSize;
-            int treeSize = _cfg.treeSize;
-
-            for (int tree = 0; tree < treeSize; tree++) {
-                FramePointSet fpsPending(frame->fps);
-                MatchNodeVec matchNodeVec;
-                frame->matchTree.push_back(matchNodeVec);
-                populate_match_node(frame->matchTree[tree], fpsPending, branchSize, leafSize, frame);
-            }
-        }
-
-        void populate_match_tree(SP<Frame> frame, SP<vector<vector<SP<MatchNodeInt>>>> matchTree, SP<FramePointVec> fpVec) {
-            for (int tree = 0; tree < (int)matchTree->size(); tree++) {
-                MatchNodeVec matchNodeVec;
-                frame->matchTree.push_back(matchNodeVec);
-
-                vector<SP<MatchNodeInt>> queueInt;
-                vector<SP<MatchNode>> queue;
-                for (auto matchNodeInt : (*matchTree)[tree]) {
-                    frame->matchTree[tree].push_back(make_shared<MatchNode>((*fpVec)[matchNodeInt->index]));
-                    queueInt.push_back(matchNodeInt);
-                    queue.push_back(frame->matchTree[tree][frame->matchTree[tree].size() - 1]);
-                }
-                while(queue.size() > 0) {
-                    auto matchNodeInt = queueInt[queueInt.size() - 1];
-                    queueInt.pop_back();
-                    auto matchNode = queue[queue.size() - 1];
-                    queue.pop_back();
-                    if (matchNodeInt->children.size() > 0) {
-                        for (auto childNodeInt : matchNodeInt->children) {
-                            matchNode->children.push_back(make_shared<MatchNode>((*fpVec)[childNodeInt->index]));
-                            queueInt.push_back(childNodeInt);
-                            queue.push_back(matchNode->children[matchNode->children.size() - 1]);
-                        }
-                    }
-                }
-            }
-        }
-
     public:
 
         FrameManager(SlamConfig& cfg): _cfg(cfg) {
@@ -150,10 +95,9 @@ class FrameManager {
          * @brief Add a new camera frame
          * 
          * @param idArg 
-         * @param kps 
-         * @param descs 
-         * @param img 
          * @param orientation 
+         * @param kps Keypoint arrays, moved into the frame. A frame point is created per keypoint.
+         * @param matchIndex Match index over the keypoints
          * @return SP<Frame> 
          */
         SP<Frame> create_frame(int idArg, 
@@ -161,8 +105,8 @@ class FrameManager {
                 float imgHeightArg, 
                 double orientation[3],
                 int64_t timestamp,
-                SP<FramePointVec> fpVec = nullptr,
-                SP<vector<vector<SP<MatchNode>>>> matchTree = nullptr) {
+                SP<FrameKeyPoints> kps,
+                SP<MatchIndex> matchIndex) {
             Vector3d trans = Vector3d(0, 0, 0);
             int invalidCount = 0;
             for (int i = 0; i < 3 && i < (int)frameList->size(); i++) {
@@ -182,24 +126,24 @@ class FrameManager {
                 imgHeight = imgHeightArg;
             }
 
-            // frame->descs = descs;
-            // if (!fpVec) {
-            //     for (int i = 0; i < (int)kps->size(); i++) {
-            //         auto desc = descs->row(i);
-            //         SP<FramePoint> fp = make_shared<FramePoint>(frame->fps.size(), 
-            //                 kps->at(i), desc, frame, _cfg.cx, _cfg.cy, 1);
-            //         frame->fps.insert(fp);
-            //     }
-            //     populate_match_tree(frame);
-            // } else {
-                for (auto fp : *fpVec) {
-                    frame->fps.insert(fp);
-                    fp->frame = frame;
-                }
-                for (int i = 0; i < (int) matchTree->size(); i++) {
-                    frame->matchTree.push_back((*matchTree)[i]);
-                }
-            // }
+            frame->kps = std::move(*kps);
+            frame->fpList.reserve(frame->kps.size());
+            for (int i = 0; i < frame->kps.size(); i++) {
+                auto fp = make_shared<FramePoint>(i, frame);
+                frame->fps.insert(fp);
+                frame->fpList.push_back(fp);
+            }
+            frame->matchIndex = matchIndex;
+            frame->grid.build(frame->kps.x.data(), frame->kps.y.data(), frame->kps.size(), _cfg.matchGridCell);
+            if (_cfg.matchMultiIndex) {
+                frame->hashIndex = make_shared<MultiIndexHash>();
+                frame->hashIndex->build(frame->kps.descs);
+            }
+            if (frame->kps.size() > 0 && frame->kps.word[0] >= 0 && !_vocabulary->empty()) {
+                frame->vocabIndex = make_shared<VocabularyIndex>();
+                frame->vocabIndex->build(*_vocabulary, frame->kps.word.data(), frame->kps.size(), _cfg.vocabMatchLevel);
+            }
+            if (_cfg.bowCandidates > 0) compute_bow(frame);
 
             if (frameList->size() > 0) {
                 (*frameList)[frameList->size() - 1]->isCurrFrame = false;
@@ -256,6 +200,11 @@ class FrameManager {
          */
         void add_keyframe(SP<Frame> frame) {
             _keyFrames->insert(frame);
+            if (_cfg.bowCandidates > 0) {
+                if (_vocabulary->empty()) _vocabulary->train(frame->kps.descs, _cfg.vocabBranchSize, _cfg.vocabDepth);
+                if (frame->bow.empty()) compute_bow(frame);
+                _keyFrameDb.add(frame);
+            }
             //Check if first frame
             if (_keyFrames->size() == 1) {
                 frame->level = 0;
@@ -263,17 +212,8 @@ class FrameManager {
                 //calculate the least level keyframe present in current frame's matches.
                 //current frames level will be that keyframe's level + 1
                 map<int, int> levelVsMatchCount;
-                for (auto fp : frame->fps) {
-                    if (fp->landmark.expired()) continue;
-                    auto landmark = fp->landmark.lock();
-                    for (auto otherFp : landmark->fps) {
-                        if (otherFp == fp) continue;
-                        if (_keyFrames->count(otherFp->frame) > 0) {
-                            auto level = otherFp->frame->level;
-                            if (levelVsMatchCount.count(level) == 0) levelVsMatchCount[level] = 1;
-                            else levelVsMatchCount[level] = levelVsMatchCount[level] + 1;
-                        }
-                    }
+                for (auto& [neighbour, sharedLandmarks] : covisibility->neighbours(frame)) {
+                    if (_keyFrames->count(neighbour) > 0) levelVsMatchCount[neighbour->level] += sharedLandmarks;
                 }
                 //Find min level with at least 4 match counts
                 int minLevel = -1;
@@ -294,8 +234,51 @@ class FrameManager {
 
         SP<FrameSet> get_keyframes() { return _keyFrames;}
 
+        /**
+         * @brief Keyframes sharing the most landmarks with frame, best first
+         *
+         * @param frame
+         * @param maxResults
+         * @return SP<FrameVec>
+         */
+        SP<FrameVec> get_covisible_keyframes(SP<Frame> frame, int maxResults) {
+            auto keyframes = make_shared<FrameVec>();
+            for (auto neighbour : *covisibility->best_neighbours(frame, (int)covisibility->neighbours(frame).size())) {
+                if ((int)keyframes->size() >= maxResults) break;
+                if (_keyFrames->count(neighbour) > 0) keyframes->push_back(neighbour);
+            }
+            return keyframes;
+        }
+
+        /**
+         * @brief Use a vocabulary trained offline for the bags of words and, for frames whose
+         * keypoints carry its words, for matching. Set before the first frame.
+         *
+         * @param vocabulary
+         */
+        void set_vocabulary(SP<Vocabulary> vocabulary) {
+            _vocabulary = vocabulary;
+        }
+
         SP<FrameSet> get_initial_keyframes() { return _initialKeyFrames;}
 
+        /**
+         * @brief Keyframes with the most similar bag of words to frame. Only the keyframes
+         * sharing a word with frame are scored.
+         *
+         * @param frame
+         * @param maxResults
+         * @return SP<FrameSet> Empty without bowCandidates
+         */
+        SP<FrameSet> get_similar_keyframes(SP<Frame> frame, int maxResults) {
+            auto similar = make_shared<FrameSet>();
+            if (_cfg.bowCandidates <= 0) return similar;
+            if (frame->bow.empty()) compute_bow(frame);
+            auto ranked = _keyFrameDb.query(frame, maxResults);
+            similar->insert(ranked->begin(), ranked->end());
+            return similar;
+        }
+
         bool check_current_or_keyframe(SP<Frame> frame) {
             return (frameList->at(frameList->size() - 1) == frame) || _keyFrames->count(frame) > 0;
         }
@@ -0,0 +1,89 @@
+/**
+ * @file keyFrameDatabase.hpp
+ * @brief Inverted file over the bags of words of the keyframes. Every word keeps the
+ * keyframes it appears in, so a query only visits the keyframes sharing a word with
+ * the query frame instead of every keyframe of the map.
+ * Key methods:
+ * 1. add: Index a keyframe by its bag of words
+ * 2. query: Keyframes most similar to a frame
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __KEYFRAME_DATABASE_HPP__
+#define __KEYFRAME_DATABASE_HPP__
+
+#include <vector>
+#include <algorithm>
+#include "../types/types.hpp"
+
+using namespace std;
+
+class KeyFrameDatabase {
+    protected:
+        struct Entry {
+            SP<Frame> frame;
+            float weight;
+        };
+        //Keyframes of every word with the weight of the word in them
+        vector<vector<Entry>> _invertedFile;
+        FrameSet _frames;
+
+    public:
+        int size() { return (int)_frames.size(); }
+
+        /**
+         * @brief Index a keyframe. Frames already indexed or without a bag of words are skipped.
+         *
+         * @param frame
+         */
+        void add(SP<Frame> frame) {
+            if (frame->bow.empty() || _frames.count(frame) > 0) return;
+            _frames.insert(frame);
+            for (auto& [word, weight] : frame->bow) {
+                if (word >= (int)_invertedFile.size()) _invertedFile.resize(word + 1);
+                _invertedFile[word].push_back({frame, weight});
+            }
+        }
+
+        void clear() {
+            _invertedFile.clear();
+            _frames.clear();
+        }
+
+        /**
+         * @brief Keyframes with the highest L1 similarity (see Vocabulary::score) to the bag
+         * of words of frame, best first. Ties are broken by frame id.
+         *
+         * @param frame
+         * @param maxResults
+         * @return SP<FrameVec>
+         */
+        SP<FrameVec> query(SP<Frame> frame, int maxResults) {
+            auto results = make_shared<FrameVec>();
+            SlotMap<Frame, float> scores;
+            for (auto& [word, weight] : frame->bow) {
+                if (word >= (int)_invertedFile.size()) continue;
+                for (auto& entry : _invertedFile[word]) {
+                    if (entry.frame == frame) continue;
+                    scores[entry.frame] += min(weight, entry.weight);
+                }
+            }
+
+            vector<pair<float, SP<Frame>>> ranked;
+            ranked.reserve(scores.size());
+            for (auto& [match, score] : scores) ranked.push_back(make_pair(score, match));
+            int count = min(maxResults, (int)ranked.size());
+            partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(), [](const auto& a, const auto& b) {
+                if (a.first != b.first) return a.first > b.first;
+                return a.second->id < b.second->id;
+            });
+            for (int i = 0; i < count; i++) results->push_back(ranked[i].second);
+            return results;
+        }
+};
+
+#endif /* __KEYFRAME_DATABASE_HPP__ */
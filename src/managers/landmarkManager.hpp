@@ -7,7 +7,8 @@
  * These are not tracked and supposed to be discarded or replaced with non-floating landmarks, 
  * if they have been judged to be valid match.
  * 2. non-floating landmarks or just landmarks: These are created and tracked by landmark manager. 
- * These are not deleted unless explicitly done so.
+ * These are not deleted unless explicitly done so. The covisibility graph is kept up to date
+ * with the points of these landmarks.
  * @author Parikshit Basu
  * @version 0.1
  * @date 2023-06-07
@@ -23,7 +24,10 @@
 #include <set>
 #include <map>
 #include <assert.h>
+#include <algorithm>
 #include "../types/types.hpp"
+#include "../utils/hamming.hpp"
+#include "covisibilityGraph.hpp"
 
 using namespace std;
 using namespace Eigen;
@@ -32,29 +36,50 @@ class LandmarkManager {
 protected:
     SlamConfig& _cfg;
     SP<LandmarkSet> _landmarks = make_shared<LandmarkSet>();
+    SP<CovisibilityGraph> _covisibility;
     int idCnt = 989900000;
 
 public:
 
 protected:
     void set_initial_estimate(SP<FramePoint> fp, Vector3d& trans) {
-        trans = Vector3d{fp->x * _cfg.maxDepth/_cfg.fx, \
-                    fp->y*_cfg.maxDepth/_cfg.fy, (double)_cfg.maxDepth};
+        trans = Vector3d{fp->x() * _cfg.maxDepth/_cfg.fx, \
+                    fp->y()*_cfg.maxDepth/_cfg.fy, (double)_cfg.maxDepth};
         trans = fp->frame->pose->trans + fp->frame->pose->rot * trans;
     }
 
+    //Only the landmarks of the map are in the covisibility graph, not the floating ones
+    bool tracked(const SP<Landmark>& landmark) {
+        return _landmarks->count(landmark) > 0;
+    }
+
+    void insert_point(const SP<Landmark>& landmark, const SP<FramePoint>& fp) {
+        if (landmark->fps.count(fp) > 0) return;
+        if (tracked(landmark)) _covisibility->add_point(*landmark, fp);
+        landmark->fps.insert(fp);
+        landmark->descStale = true;
+    }
+
+    void erase_point(const SP<Landmark>& landmark, const SP<FramePoint>& fp) {
+        if (landmark->fps.count(fp) == 0) return;
+        if (tracked(landmark)) _covisibility->remove_point(*landmark, fp);
+        landmark->fps.erase(fp);
+        landmark->descStale = true;
+    }
+
 public:
-    LandmarkManager(SlamConfig& cfg) : 
-    _cfg(cfg) {}
+    LandmarkManager(SlamConfig& cfg, SP<CovisibilityGraph> covisibility = nullptr) : 
+    _cfg(cfg),
+    _covisibility(covisibility? covisibility : make_shared<CovisibilityGraph>()) {}
 
     SP<Landmark> create_landmark(SP<FramePoint> fp, double distance) {
         auto landmark = make_shared<Landmark>();
-        landmark->id = idCnt;
-        idCnt++;
+        assign_id(landmark);
         _landmarks->insert(landmark);
         fp->landmark = landmark;
         fp->matchDistance = distance;
         landmark->fps.insert(fp);
+        update_descriptor(landmark);
 
         set_initial_estimate(fp, landmark->trans);
 
@@ -66,11 +91,14 @@ public:
 
     SP<Landmark> create_floating_landmark_l(SP<Landmark> srcLandmark, SP<FramePoint> fp = nullptr) {
         SP<Landmark> landmark = make_shared<Landmark>();
+        landmark->bind_slot();
         landmark->trans[0] = srcLandmark->trans[0];
         landmark->trans[1] = srcLandmark->trans[1];
         landmark->trans[2] = srcLandmark->trans[2];
         // landmark->fixed = srcLandmark->fixed;
         for (auto ele : srcLandmark->fps) landmark->fps.insert(ele);
+        memcpy(landmark->desc, srcLandmark->desc, DESC_BYTES);
+        landmark->descStale = srcLandmark->descStale;
         landmark->id = srcLandmark->id;
         // landmark->srcLandmark = srcLandmark;
 
@@ -82,7 +110,13 @@ public:
         return landmark;
     }
 
-    SP<Landmark> create_floating_landmark_fp(SP<FramePoint> fp1, SP<FramePoint> fp2) {
+    /**
+     * @brief Landmark joining two framepoints that is not added to the map.
+     * With assignId false the id is left at -1, without a slot, and only shared
+     * state is read, so concurrent matching tasks can create landmarks. assign_id
+     * numbers them once the tasks are done.
+     */
+    SP<Landmark> create_floating_landmark_fp(SP<FramePoint> fp1, SP<FramePoint> fp2, bool assignId = true) {
         assert(fp1 != fp2);
         SP<Landmark> landmark = make_shared<Landmark>();
         
@@ -103,13 +137,23 @@ public:
         
         landmark->fps.insert(fp1);
         landmark->fps.insert(fp2);
-        landmark->id = idCnt;
-        idCnt++;
+        update_descriptor(landmark);
+        landmark->id = -1;
+        if (assignId) assign_id(landmark);
 
         return landmark;
     }
 
+    //The slot is taken here rather than on construction, so the slots follow the ids and
+    //do not depend on the order concurrent matching tasks ran in
+    void assign_id(SP<Landmark> landmark) {
+        landmark->id = idCnt;
+        idCnt++;
+        landmark->bind_slot();
+    }
+
     void remove_landmark(SP<Landmark> landmark) {
+        if (tracked(landmark)) _covisibility->remove_landmark(*landmark);
         for (auto fp : landmark->fps) {
             if (landmark == fp->landmark.lock()) {
                 fp->landmark.reset();
@@ -121,7 +165,7 @@ public:
 
     //Return value is true if landmark itself got deleted.
     bool remove_point_from_landmark(SP<Landmark> landmark, SP<FramePoint> fp) {
-        landmark->fps.erase(fp);
+        erase_point(landmark, fp);
         //FP can be associated with multiple temporary floating landmarks too.
         //So before resetting the FP landmark, check if that is the landmark being modified
         if (landmark == fp->landmark.lock()) {
@@ -132,6 +176,7 @@ public:
             remove_landmark(landmark);
             return true;
         }
+        update_descriptor(landmark);
         return false;
     }
 
@@ -147,9 +192,10 @@ public:
 
     void merge_landmarks(SP<Landmark> ref, SP<Landmark> merge) {
         if (ref->id != merge->id) {
+            if (tracked(merge)) _covisibility->remove_landmark(*merge);
             //Copy over the points from second landmark to first
             for (auto fp : merge->fps) {
-                ref->fps.insert(fp);
+                insert_point(ref, fp);
                 fp->landmark = ref;
             }
 
@@ -168,7 +214,44 @@ public:
 
     SP<LandmarkSet> get_landmarks() { return _landmarks; }
 
-    static void dedupe_landmark_points(SP<Landmark> landmark) {
+    /**
+     * @brief Set the representative descriptor of the landmark, the descriptor of its points
+     * with the least median distance to the others. With two points neither is more central,
+     * the point of the latest frame is kept as it is the likeliest to look like the next one.
+     * Only recomputed when the points changed since the last update.
+     * 
+     * @param landmark 
+     */
+    static void update_descriptor(SP<Landmark> landmark) {
+        const int n = (int)landmark->fps.size();
+        if (n == 0 || !landmark->descStale) return;
+        landmark->descStale = false;
+        if (n <= 2) {
+            SP<FramePoint> latest;
+            for (auto& fp : landmark->fps) {
+                if (!latest || fp->frame->id > latest->frame->id) latest = fp;
+            }
+            memcpy(landmark->desc, latest->desc(), DESC_BYTES);
+            return;
+        }
+        vector<const uchar*> descs;
+        descs.reserve(n);
+        for (auto& fp : landmark->fps) descs.push_back(fp->desc());
+        const uchar* best = descs[0];
+        vector<int> distances(n);
+        int bestMedian = -1;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) distances[j] = HammingDistance::distance(descs[i], descs[j]);
+            nth_element(distances.begin(), distances.begin() + n/2, distances.end());
+            if (bestMedian == -1 || distances[n/2] < bestMedian) {
+                bestMedian = distances[n/2];
+                best = descs[i];
+            }
+        }
+        memcpy(landmark->desc, best, DESC_BYTES);
+    }
+
+    void dedupe_landmark_points(SP<Landmark> landmark) {
         set<int> frameIds;
         for (auto point : landmark->fps) {
             frameIds.insert(point->frame->id);
@@ -184,7 +267,7 @@ public:
                 for (auto duplicate : duplicates) {
                     double distance = 0;
                     for (auto point : landmark->fps) {
-                        if (duplicate != point) distance += norm(duplicate->desc, point->desc, NORM_HAMMING);
+                        if (duplicate != point) distance += HammingDistance::distance(duplicate->desc(), point->desc());
                     }
                     if (-1 == minDistance || distance < minDistance) {
                         minDistance = distance;
@@ -202,16 +285,17 @@ public:
                         // }
                         duplicate->landmark.reset();
                         duplicate->matchDistance = INITIAL_DISTANCE;
-                        landmark->fps.erase(duplicate);
+                        erase_point(landmark, duplicate);
                         DEBUG_COUT(frameId<<":"<<duplicate->id<<":"<<landmark->id<<": Dedupe deleted"<<endl);
                         DEBUG_COUT(frameId<<"Deduped "<<duplicate->id<<" VS "<<selectedPoint->id<<endl);
                     }
                 }
             }
         }
+        update_descriptor(landmark);
     }
 
-    static void link_landmark_point(SP<Landmark> landmark, SP<FramePoint> fp, double distance) {
+    void link_landmark_point(SP<Landmark> landmark, SP<FramePoint> fp, double distance) {
         // {
         //     DEBUG_COUT(fp->frameId<<":"<<fp->id;
         //     if (fp->landmark.expired())
@@ -219,7 +303,7 @@ public:
         //     else 
         //         DEBUG_COUT(" Link FP L "<<landmark->id<<" FP's L "<<fp->landmark.lock()->id<<endl;
         // }
-        landmark->fps.insert(fp);
+        insert_point(landmark, fp);
         fp->landmark = landmark;
         fp->matchDistance = distance;
         // DEBUG_COUT("Linking Landmark:"<<landmark->id<<" FrameID:"<<fp->frameId<<" KPID:"<<fp->id<<endl;
@@ -14,6 +14,9 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <queue>
+#include <random>
+#include <cmath>
 #include "landmarkManager.hpp"
 #include "frameManager.hpp"
 #include "../utils/transformUtils.hpp"
@@ -29,7 +32,7 @@ class Matcher {
         SP<FrameManager> _fm;
         g2o::CameraParameters* _camera;
         Vector3d _origin = Vector3d(0, 0, 0);
-        SP<LandmarkSet> emptyLandmarkSet = make_shared<LandmarkSet>();
+        SP<LandmarkVec> emptyLandmarkVec = make_shared<LandmarkVec>();
 
         void set_distances(
             const double distance, 
@@ -57,6 +60,36 @@ class Matcher {
             return make_tuple(newKp[0], newKp[1]);
         }
 
+        //Box in the match frame holding every keypoint whose rotated projection is within
+        //maxGap of (refX, refY). The rotation maps the image plane by a homography, so the
+        //square around the gap circle maps to the quadrilateral of its projected corners as
+        //long as the square stays in front of the camera, and the box of the corners holds
+        //the projected circle. Otherwise the box is unbounded.
+        tuple<float, float, float, float> get_search_window(
+            const Quaterniond& rotInv, 
+            const float refX, 
+            const float refY) 
+        {
+            Quaterniond rot(rotInv);
+            rot.normalize();
+            float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+            const float corners[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+            for (auto& corner : corners) {
+                const float x = refX + corner[0]*_cfg.maxGap;
+                const float y = refY + corner[1]*_cfg.maxGap;
+                //Depth of the corner after the rotation, see get_rotated_projection
+                if ((rot.conjugate()*Vector3d(x*100/_cfg.fx, y*100/_cfg.fx, 100)).z() <= 0) {
+                    return make_tuple(-INFINITY, -INFINITY, INFINITY, INFINITY);
+                }
+                auto [projX, projY] = get_rotated_projection(rotInv, x, y);
+                minX = min(minX, projX);
+                minY = min(minY, projY);
+                maxX = max(maxX, projX);
+                maxY = max(maxY, projY);
+            }
+            return make_tuple(minX, minY, maxX, maxY);
+        }
+
         bool valid_distance(
             double distance1, 
             double distance2) 
@@ -71,49 +104,140 @@ class Matcher {
             return true;
         }
 
-        tuple<SP<FramePoint>, double, double> match_nodes(
+        /**
+         * @brief Best-bin-first search of the frame's match index. The trees are searched
+         * together: every node is checked against currFp and the nodes are expanded in the
+         * order of their descriptor distance, until matchChecks distances have been computed.
+         * Only keypoints within the gap of currFp are candidates, but the subtrees of the
+         * others are still explored.
+         * 
+         * @return tuple<SP<FramePoint>, double, double, double> Nearest candidate, its distance,
+         * the distance of the second nearest distinct candidate (-1 if none) and the gap of the nearest
+         */
+        tuple<SP<FramePoint>, double, double, double> match_nodes(
             SP<FramePoint> currFp, 
-            MatchNodeVec& matchNodes, 
-            const Quaterniond& rotDiff,
-            SP<FrameSet> descriptorFrames) 
+            const Frame& frame,
+            const Quaterniond& rotDiff) 
         {
-            SP<FramePoint> matchFp;
-            double minDistance = -1;
-            SP<MatchNode> minNode;
-            // MatchPriorityQueue que;
-            for (auto matchNode : matchNodes) {
-                auto prevFp = matchNode->fp;
-                auto distance = TransformUtils::get_distance(prevFp, currFp, descriptorFrames);
-                // que.push_back(make_pair(matchNode, distance));
-                if (minDistance == -1 || minDistance > distance) {
-                    minDistance = distance;
-                    minNode = matchNode;
+            const auto& matchIndex = *frame.matchIndex;
+            const auto& nodes = matchIndex.nodes;
+            using NodeDistance = pair<double, int>;
+            priority_queue<NodeDistance, vector<NodeDistance>, greater<NodeDistance>> queue;
+            int checks = 0;
+            int bestIndex = -1;
+            double distance1 = -1, distance2 = -1, bestGap = 0;
+
+            auto check = [&](int node) {
+                const int index = nodes[node].index;
+                auto distance = TransformUtils::get_distance(frame.fpList[index], currFp);
+                checks++;
+                auto [valid, gap] = valid_gap(currFp->x(), currFp->y(), frame.kps.x[index], frame.kps.y[index], rotDiff);
+                //The trees hold the same keypoints, a keypoint found again is not a second candidate
+                if (valid && index != bestIndex) {
+                    if (distance1 == -1 || distance < distance1) {
+                        distance2 = distance1;
+                        distance1 = distance;
+                        bestIndex = index;
+                        bestGap = gap;
+                    } else if (distance2 == -1 || distance < distance2) {
+                        distance2 = distance;
+                    }
+                }
+                if (nodes[node].childEnd > nodes[node].childBegin) queue.push(make_pair(distance, node));
+            };
+
+            for (int root : matchIndex.treeRoots) {
+                for (int node = nodes[root].childBegin; node < nodes[root].childEnd && checks < _cfg.matchChecks; node++) {
+                    check(node);
+                }
+            }
+            while (!queue.empty() && checks < _cfg.matchChecks) {
+                const int parent = queue.top().second;
+                queue.pop();
+                for (int node = nodes[parent].childBegin; node < nodes[parent].childEnd && checks < _cfg.matchChecks; node++) {
+                    check(node);
                 }
             }
-            // std::sort(que.begin(), que.end(), [](MatchNodeDist& a, MatchNodeDist& b) {
-            //     return a.second > b.second;
-            // });
-            // while(!matchFp && que.size()>0) {
-                // auto lastEle = que[que.size() - 1];
-                // minNode = lastEle.first;
-                // minDistance = lastEle.second;
-                // que.pop_back();
-                auto [valid, gap] = valid_gap(
-                    currFp->x, 
-                    currFp->y, 
-                    minNode->fp->x, 
-                    minNode->fp->y, 
-                    rotDiff);
-                if ( valid && minDistance <= _cfg.distanceThreshold) {
-                    matchFp = minNode->fp;
-                    // cout<<currFp->id<<" Match Found ";
-                    // cout<<minNode->fp->id<<" dist "<<minDistance<<endl;
-                } else if (minNode->children.size() > 0) {
-                    tie(matchFp, minDistance, gap) = match_nodes(
-                            currFp, minNode->children, rotDiff, descriptorFrames);
+
+            SP<FramePoint> matchFp = bestIndex == -1? nullptr : frame.fpList[bestIndex];
+            return make_tuple(matchFp, distance1, distance2, bestGap);
+        }
+
+        /**
+         * @brief Exact nearest neighbours of currFp among the keypoints of frame within the gap,
+         * with the frame's multi-index hash. The frame side is compared by keypoint descriptor,
+         * currFp by its landmark's descriptor if it has one. The search widens until the nearest
+         * and second nearest are known, or until the ratio test cannot change, or, with no
+         * candidate yet, until nothing closer than distanceThreshold can be left. So whatever
+         * distanceThreshold is, the match is accepted or rejected as by a brute force search.
+         * 
+         * @return tuple<SP<FramePoint>, double, double, double> Nearest candidate, its distance,
+         * the distance of the second nearest candidate (-1 if none) and the gap of the nearest
+         */
+        tuple<SP<FramePoint>, double, double, double> match_multi_index(
+            SP<FramePoint> currFp, 
+            const Frame& frame,
+            const Quaterniond& rotDiff) 
+        {
+            auto landmark = currFp->landmark.lock();
+            const uchar* query = landmark? landmark->desc : currFp->desc();
+            int bestIndex = -1;
+            double distance1 = -1, distance2 = -1, bestGap = 0;
+            frame.hashIndex->search(query, 
+                [&](int index, int distance) {
+                    //Cannot change the two nearest, the gap test is skipped
+                    if (distance2 != -1 && distance >= distance2) return;
+                    auto [valid, gap] = valid_gap(currFp->x(), currFp->y(), frame.kps.x[index], frame.kps.y[index], rotDiff);
+                    if (!valid) return;
+                    if (distance1 == -1 || distance < distance1) {
+                        distance2 = distance1;
+                        distance1 = distance;
+                        bestIndex = index;
+                        bestGap = gap;
+                    } else if (distance2 == -1 || distance < distance2) {
+                        distance2 = distance;
+                    }
+                },
+                [&](int radius) {
+                    //Every candidate within radius has been visited
+                    if (distance2 != -1 && distance2 <= radius) return true;
+                    //Nothing closer than distanceThreshold is left, the point is not matched
+                    if (radius + 1 >= _cfg.distanceThreshold && 
+                        (distance1 == -1 || distance1 >= _cfg.distanceThreshold)) return true;
+                    return distance1 != -1 && distance1 <= _cfg.ratio*(radius + 1);
+                });
+
+            SP<FramePoint> matchFp = bestIndex == -1? nullptr : frame.fpList[bestIndex];
+            return make_tuple(matchFp, distance1, distance2, bestGap);
+        }
+
+        /**
+         * @brief Nearest neighbours of currFp within the gap among the keypoints of frame
+         * that share its vocabulary node at vocabMatchLevel. Both frames need a vocabIndex.
+         * 
+         * @return tuple<SP<FramePoint>, double, double, double> Nearest candidate, its distance,
+         * the distance of the second nearest candidate (-1 if none) and the gap of the nearest
+         */
+        tuple<SP<FramePoint>, double, double, double> match_vocabulary(
+            SP<FramePoint> currFp, 
+            const Frame& frame,
+            const Quaterniond& rotDiff) 
+        {
+            SP<FramePoint> matchFp;
+            double distance1 = -1, distance2 = -1, bestGap = 0;
+            int node = currFp->frame->vocabIndex->node(currFp->id);
+            frame.vocabIndex->query(node, [&](int index) {
+                auto [valid, gap] = valid_gap(currFp->x(), currFp->y(), frame.kps.x[index], frame.kps.y[index], rotDiff);
+                if (!valid) return;
+                auto fp = frame.fpList[index];
+                auto distance = TransformUtils::get_distance(fp, currFp);
+                set_distances(distance, distance1, distance2);
+                if (distance1 == distance) {
+                    matchFp = fp;
+                    bestGap = gap;
                 }
-            // }
-            return make_tuple(matchFp, minDistance, gap);
+            });
+            return make_tuple(matchFp, distance1, distance2, bestGap);
         }
 
     public:
@@ -136,51 +260,70 @@ class Matcher {
             return make_tuple(true, gap);
         }
 
-        SP<LandmarkSet> match_fps(
+        /**
+         * @brief Match the framepoints prevFps against currFrame. Only reads shared state,
+         * so several match frames can be matched concurrently: the floating landmarks are
+         * returned in the order they were created, without ids (see LandmarkManager::assign_id),
+         * and framepoints are drawn with an engine seeded by seed instead of rand().
+         *
+         * @param currFrame
+         * @param prevFps
+         * @param maxMatches
+         * @param minAvgGap
+         * @param seed
+         * @return SP<LandmarkVec> Empty if the average gap is below minAvgGap
+         */
+        SP<LandmarkVec> match_fps(
             SP<Frame> currFrame,  
-            FramePointSet& prevFps, 
-            SP<FrameSet> descriptorFrames,
+            const FramePointSet& prevFps, 
             int maxMatches,
-            double minAvgGap) 
+            double minAvgGap,
+            unsigned seed) 
         {
-            if (prevFps.size() == 0) return emptyLandmarkSet;
+            if (prevFps.size() == 0) return emptyLandmarkVec;
             SP<Frame> prevFrame = (*prevFps.begin())->frame;
-            auto landmarkSet = make_shared<LandmarkSet>();
+            auto landmarks = make_shared<LandmarkVec>();
             LandmarkDistancePairVec ldPairVec;
             auto rotDiff = (currFrame->pose->rot.conjugate() * prevFrame->pose->rot);
+            auto rotInv = rotDiff.conjugate();
             double totalGap = 0;
             int totalPts = 0;
 
-            FramePointSet fpsPending;
-            fpsPending.insert(prevFps.begin(), prevFps.end());
+            FramePointVec fpsPending(prevFps.begin(), prevFps.end());
+            minstd_rand rng(seed);
+            //Frames extracted with a loaded vocabulary are matched by vocabulary node
+            const bool useVocabulary = currFrame->vocabIndex && prevFrame->vocabIndex;
 
-            while(fpsPending.size() > 0 && (int)landmarkSet->size() < maxMatches) {
-                auto prevFp = TransformUtils::pop_random<SP<FramePoint>>(fpsPending);
+            while(fpsPending.size() > 0 && (int)landmarks->size() < maxMatches) {
+                swap(fpsPending[rng() % fpsPending.size()], fpsPending.back());
+                auto prevFp = fpsPending.back();
+                fpsPending.pop_back();
                 SP<FramePoint> matchFp;
                 double distance1 = -1;
                 double distance2 = -1;
                 double matchGap = 0;
 
-                if (_cfg.matchHierarchy) {
-                    for (auto matchNodes : currFrame->matchTree) {
-                        auto [fp, distance, gap] = match_nodes(prevFp, matchNodes, rotDiff, descriptorFrames);
-                        set_distances(distance, distance1, distance2);
-                        if (distance1 == distance) {
-                            matchFp = fp;
-                            matchGap = gap;
-                        }
-                    }
+                if (useVocabulary) {
+                    tie(matchFp, distance1, distance2, matchGap) = match_vocabulary(prevFp, *currFrame, rotDiff);
+                } else if (_cfg.matchMultiIndex) {
+                    tie(matchFp, distance1, distance2, matchGap) = match_multi_index(prevFp, *currFrame, rotDiff);
+                } else if (_cfg.matchHierarchy) {
+                    tie(matchFp, distance1, distance2, matchGap) = match_nodes(prevFp, *currFrame, rotDiff);
                 } else {
-                    for (auto currFp : currFrame->fps) {
-                        auto [valid, gap] = valid_gap(prevFp->x, prevFp->y, currFp->x, currFp->y, rotDiff);
-                        if (!valid) continue;
-                        auto distance = TransformUtils::get_distance(currFp, prevFp, descriptorFrames);
+                    //Only the keypoints the rotation can bring within the gap are compared
+                    const auto& kps = currFrame->kps;
+                    auto [minX, minY, maxX, maxY] = get_search_window(rotInv, prevFp->x(), prevFp->y());
+                    currFrame->grid.query(minX, minY, maxX, maxY, [&](int i) {
+                        auto [valid, gap] = valid_gap(prevFp->x(), prevFp->y(), kps.x[i], kps.y[i], rotDiff);
+                        if (!valid) return;
+                        auto currFp = currFrame->fpList[i];
+                        auto distance = TransformUtils::get_distance(currFp, prevFp);
                         set_distances(distance, distance1, distance2);
                         if (distance1 == distance) {
                             matchFp = currFp;
                             matchGap = gap;
                         }
-                    }
+                    });
                 }
 
                 if (matchFp) {
@@ -192,8 +335,8 @@ class Matcher {
                         // cout<<matchPt.x<<", "<<matchPt.y<<" Summary ";
                         // cout<<cv::norm(matchPt-currFp->kp.pt)<<endl;
                         SP<Landmark> landmark;
-                        landmark = _lm->create_floating_landmark_fp(prevFp, matchFp);
-                        landmarkSet->insert(landmark);
+                        landmark = _lm->create_floating_landmark_fp(prevFp, matchFp, false);
+                        landmarks->push_back(landmark);
                         if (landmark->fps.size() == 1) {
                             cout<<"Match Frames Landmark "<<landmark->id<<" size "<<landmark->fps.size()<<endl;
                             assert(false);
@@ -205,9 +348,9 @@ class Matcher {
             }
 
             if (totalGap/totalPts >= minAvgGap) {
-                return landmarkSet;
+                return landmarks;
             } else {
-                return emptyLandmarkSet;
+                return emptyLandmarkVec;
             }
         }
 };
@@ -18,6 +18,8 @@
 // for std
 #include <iostream>
 #include <map>
+#include <atomic>
+#include <random>
 // for opencv 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/core.hpp>
@@ -30,6 +32,7 @@
 // for g2o
 
 #include "../utils/timer.hpp"
+#include "../utils/threadPool.hpp"
 #include "matcher.hpp"
 #include "baHelper.hpp"
 
@@ -46,7 +49,14 @@ class PoseManager {
         SP<LandmarkManager> _lm;
         SP<Matcher> _matcher;
         SP<FrameManager> _fm;
+        //Match frames are matched concurrently on it, inline when null
+        ThreadPool* _threadPool;
+        //Arenas of the frames whose outputs are still held, and the one of the frame being added
+        vector<SP<FrameArena>> _arenas;
+        SP<FrameArena> _arena;
         bool _initialized = false;
+        //Only drawn from by the pose stage, independent of the extraction stage's draws
+        mt19937 _rng;
         cv::Mat _cameraMatrix = (cv::Mat_<double>(3, 3) << 466, 0, 0, 0, 466, 0, 0, 0, 1);//cv::Mat::eye(3, 3, CV_64F); 
         cv::Mat _distCoeffs = (cv::Mat_<double>(5, 1) << -0.00384385, 0.00176262, -0.00070753, -0.00131189,  -0.0103289);
         // cv::Mat _distCoeffs = (cv::Mat_<double>(5, 1) << 0.0, 0.0, 0.0, 0.0, 0.0);
@@ -60,7 +70,8 @@ class PoseManager {
                 _fm, 
                 _lm, 
                 _cameraMatrix, 
-                _distCoeffs);
+                _distCoeffs,
+                _arena.get());
         }
 
         SP<BaHelper> generate_ba_helper(
@@ -73,7 +84,37 @@ class PoseManager {
                 _fm, 
                 _lm,
                 cameraMatrix, 
-                _distCoeffs);
+                _distCoeffs,
+                _arena.get());
+        }
+
+        /**
+         * @brief Arena for the scratch data of the next frame. An arena is only reused once
+         * the output of its frame and every object made on it by arena_shared have been
+         * released, any other free arena is dropped so the pool does not keep the peak of a
+         * burst of held outputs.
+         * 
+         * @return SP<FrameArena> 
+         */
+        SP<FrameArena> acquire_arena() {
+            SP<FrameArena> arena;
+            for (auto it = _arenas.begin(); it != _arenas.end();) {
+                if (it->use_count() > 1) {
+                    it++;
+                } else if (!arena) {
+                    //The output may have been released on another thread
+                    atomic_thread_fence(memory_order_acquire);
+                    arena = *it++;
+                    arena->reset();
+                } else {
+                    it = _arenas.erase(it);
+                }
+            }
+            if (!arena) {
+                arena = make_shared<FrameArena>();
+                _arenas.push_back(arena);
+            }
+            return arena;
         }
 
         /**
@@ -237,6 +278,13 @@ class PoseManager {
             return frameSortVec;
         }
 
+        SP<Frame> get_last_valid_frame(SP<Frame> currFrame) {
+            for (auto it = _fm->frameList->rbegin(); it != _fm->frameList->rend(); it++) {
+                if (*it != currFrame && (*it)->valid) return *it;
+            }
+            return nullptr;
+        }
+
         /**
          * @brief Generates suitable match frames for current frame from the keyframes and past frames.
          * 
@@ -255,7 +303,19 @@ class PoseManager {
                     if (currFrame == frame || keyframes->count(frame) > 0) continue;
                     prevFrameSet.insert(frame);
                 }
-                keyFrameRanks = generate_keyframe_ranks(currFrame, *keyframes, 1.0);
+                //Only the keyframes that look most alike, and those sharing the most landmarks
+                //with the last valid frame, are ranked by pose, unless there are too few of them
+                auto candidates = keyframes;
+                if (_cfg.bowCandidates > 0 || _cfg.covisibleCandidates > 0) {
+                    auto similar = _fm->get_similar_keyframes(currFrame, _cfg.bowCandidates);
+                    auto lastFrame = get_last_valid_frame(currFrame);
+                    if (lastFrame && _cfg.covisibleCandidates > 0) {
+                        auto covisible = _fm->get_covisible_keyframes(lastFrame, _cfg.covisibleCandidates);
+                        similar->insert(covisible->begin(), covisible->end());
+                    }
+                    if ((int)similar->size() >= _cfg.numKeyFrameMatches) candidates = similar;
+                }
+                keyFrameRanks = generate_keyframe_ranks(currFrame, *candidates, 1.0);
                 if ((int)keyFrameRanks->size() > 0) {
                     matchFrames->insert(keyFrameRanks->at(0)->frame);
                     keyFrameRanks->erase(keyFrameRanks->begin());
@@ -272,7 +332,7 @@ class PoseManager {
                     }
                     
                     if ((int)matchFrames->size() < _cfg.numKeyFrameMatches) {
-                        keyFrameRanks = generate_keyframe_ranks(currFrame, *keyframes, 2.0);
+                        keyFrameRanks = generate_keyframe_ranks(currFrame, *candidates, 2.0);
                         for (int i = 0; (int)matchFrames->size() < _cfg.numKeyFrameMatches &&\
                                 i < (int)keyFrameRanks->size(); i++) {
                             matchFrames->insert(keyFrameRanks->at(i)->frame);
@@ -301,7 +361,7 @@ class PoseManager {
          * @return int 
          */
         int find_focus(SP<Frame> currFrame, int focusStart, int focusEnd, int divisions) {
-            auto goodLandmarks = make_shared<LandmarkSet>();
+            auto goodLandmarks = arena_shared<LandmarkSet>(_arena.get(), _arena.get());
             for (auto frame : *_fm->get_keyframes()) {
                 for (auto fp : frame->fps) {
                     auto landmark = fp->landmark.lock();
@@ -351,11 +411,13 @@ class PoseManager {
             SlamConfig& cfg, 
             SP<LandmarkManager> lm, 
             SP<Matcher> matcher, 
-            SP<FrameManager> fm
+            SP<FrameManager> fm,
+            ThreadPool* threadPool = nullptr
         ) : _cfg(cfg), 
             _lm(lm), 
             _matcher(matcher), 
-            _fm(fm)
+            _fm(fm),
+            _threadPool(threadPool)
         {
             _cameraMatrix.at<double>(0, 0) = _cfg.fx;
             _cameraMatrix.at<double>(1, 1) = _cfg.fy;
@@ -382,6 +444,14 @@ class PoseManager {
             DEBUG_COUT(currFrame->id<<":"<<LOG_START<<endl);
             cout<<"Add Frame"<<endl;
             auto output = make_shared<PoseManagerOutput>();
+            //The scratch data of the frame goes on the arena, which the output keeps alive
+            _arena = acquire_arena();
+            output->arena = _arena;
+            struct ArenaRelease {
+                SP<FrameArena>& arena;
+                ~ArenaRelease() { arena = nullptr; }
+            } arenaRelease{_arena};
+            auto arena = _arena.get();
             output->frame = currFrame;
             for (int i = 0; i < 4; i++) {
                 output->results.push_back(vector<SP<BaHelperOutput>>());
@@ -422,7 +492,7 @@ class PoseManager {
             
             {
                 // map<SP<Frame>, FramePointVec> frameFps;
-                map<SP<Frame>, LandmarkVec> frameMatches;
+                SlotMap<Frame, LandmarkVec> frameMatches(arena);
                 int ransacMatchSize = 6;
                 if (ransacMatchSize < (int)matchFrames->size()) 
                     ransacMatchSize = matchFrames->size();
@@ -433,22 +503,36 @@ class PoseManager {
 
                 matchTimer.start();
                 FrameVec badFrames;
-                auto descriptorFrames = make_shared<FrameSet>();
-                descriptorFrames->insert(currFrame);
-                descriptorFrames->insert(matchFrames->begin(), matchFrames->end());
-                descriptorFrames->insert(_fm->get_keyframes()->begin(), _fm->get_keyframes()->end());
-
-                for (auto frame : *matchFrames) {
-                    auto matchSet = _matcher->match_fps(
-                        frame, 
+
+                //Every match frame is matched on its own task. The seeds are drawn and the
+                //landmark ids assigned in matchFrames order once all tasks are done, so the
+                //matches do not depend on how the tasks were scheduled.
+                FrameVec frames(matchFrames->begin(), matchFrames->end());
+                vector<unsigned> seeds(frames.size());
+                for (auto& seed : seeds) seed = (unsigned)_rng();
+                vector<SP<LandmarkVec>> matchSets(frames.size());
+                auto matchFrame = [&](int i) {
+                    matchSets[i] = _matcher->match_fps(
+                        frames[i], 
                         currFrame->fps, 
-                        descriptorFrames, 
                         maxMatchesPerFrame, 
-                        _initialized? _cfg.minAvgGap : _cfg.minAvgGapInit);
+                        _initialized? _cfg.minAvgGap : _cfg.minAvgGapInit,
+                        seeds[i]);
+                };
+                if (_threadPool) {
+                    _threadPool->parallel_for(0, (int)frames.size(), matchFrame);
+                } else {
+                    for (int i = 0; i < (int)frames.size(); i++) matchFrame(i);
+                }
+
+                for (int f = 0; f < (int)frames.size(); f++) {
+                    auto frame = frames[f];
+                    auto matchSet = matchSets[f];
+                    for (auto l : *matchSet) _lm->assign_id(l);
                     if (matchSet->size() > 3) {
                         for (auto l : *matchSet) frameMatches[frame].push_back(l);
                         for (int i = 0; i < maxMatchesPerFrame - (int)matchSet->size(); i++) {
-                           frameMatches[frame].push_back(frameMatches[frame][rand() % matchSet->size()]);
+                           frameMatches[frame].push_back(frameMatches[frame][_rng() % matchSet->size()]);
                         }
                     } else {
                         cout<<currFrame->id<<": Not enough matches from "<<frame->id<<endl;
@@ -470,7 +554,7 @@ class PoseManager {
                     return output;
                 }
 
-                auto frameSet = make_shared<FrameSet>();
+                auto frameSet = arena_shared<FrameSet>(arena, arena);
                 frameSet->insert(currFrame);
                 frameSet->insert(matchFrames->begin(), matchFrames->end());
                 for (auto frame : *matchFrames) _fm->add_keyframe(frame);
@@ -482,7 +566,7 @@ class PoseManager {
                 ransacTimer.start();
                 for (int i = 0; i < ransacIters/2; i++) {
                     DEBUG_COUT(currFrame->id<<":0:"<<i<<":"<<LOG_START<<endl);
-                    auto ransacSet = make_shared<LandmarkSet>();
+                    auto ransacSet = arena_shared<LandmarkSet>(arena, arena);
                     for (auto frame : *matchFrames) {
                         for (int j = 0; j < maxMatchesPerFramePerIter;j++) {
                             // DEBUG_COUT("Frame Matches "<<frame->id<<" ransac iter "<<i<<" ransacMatchSize "<<ransacMatchSize<<" match frame size "<<matchFrames->size()<<" j "<<j<<endl);
@@ -522,13 +606,13 @@ class PoseManager {
                 SP<BaHelper> bestBaHelper;
 
                 winnerTimer.start();
-                auto evalSet = make_shared<LandmarkSet>();
+                auto evalSet = arena_shared<LandmarkSet>(arena, arena);
                 for (auto& [frame, matches] : frameMatches) {
-                    LandmarkSet ransacSet;
+                    LandmarkSet ransacSet(arena);
                     ransacSet.insert(matches.begin(), matches.end());
                     int maxLen = ransacSet.size() >= 3? 3 : ransacSet.size();
                     for (int i = 0; i < maxLen; i++) 
-                        evalSet->insert(TransformUtils::pop_random<SP<Landmark>>(ransacSet));
+                        evalSet->insert(TransformUtils::pop_random(ransacSet, _rng));
                 }
                 DEBUG_COUT("Eval set prepared, size "<<evalSet->size()<<endl);
 
@@ -567,7 +651,7 @@ class PoseManager {
                 //Complete iterations
                 validTimer.start();
                 {
-                    auto allSet = make_shared<LandmarkSet>();
+                    auto allSet = arena_shared<LandmarkSet>(arena, arena);
                     for (auto& [frame, matches] : frameMatches) {
                         LandmarkSet ransacSet;
                         allSet->insert(matches.begin(), matches.end());
@@ -621,7 +705,7 @@ class PoseManager {
                         auto fixedLandmarks = vo->landmarkResult->get(FIXED);
                         auto validFrames = vo->frameResult->get(VALID);
                         auto fixedFrames = vo->frameResult->get(FIXED);
-                        auto landmarkSet = make_shared<LandmarkSet>();
+                        auto landmarkSet = arena_shared<LandmarkSet>(arena, arena);
                         for (auto fp : currFrame->fps) {
                             auto landmark = fp->landmark.lock();
                             if (landmark) {
@@ -638,7 +722,7 @@ class PoseManager {
                                 }
                             }
                         }
-                        auto newFrameSet = make_shared<FrameSet>();
+                        auto newFrameSet = arena_shared<FrameSet>(arena, arena);
                         newFrameSet->insert(frameSet->begin(), frameSet->end());
                         newFrameSet->insert(_fm->get_keyframes()->begin(), _fm->get_keyframes()->end());
                         auto baHelper = generate_ba_helper(currFrame);
@@ -8,6 +8,8 @@
  * 1. extract_keypoints: Used to add a new camera image and extract keypoints
  * 2. process: Process the generated keypoints for pose computation
  * 2. initialize: Used to initialize the SLAM system after a few frames have been added
+ * 3. submit_frame: Runs extract_keypoints and process as a two stage pipeline
+ * 4. load_vocabulary: Load a vocabulary trained offline, used for matching and keyframe search
  * @author Parikshit Basu
  * @version 0.1
  * @date 2023-06-07
@@ -21,9 +23,16 @@
 // for std
 #include <iostream>
 #include <map>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <deque>
 
 #include "../imageAnalysis/orbExtractor.h"
 #include "../utils/timer.hpp"
+#include "../utils/threadPool.hpp"
+#include "../utils/matchIndex.hpp"
+#include "../types/exportData.hpp"
 #include "../managers/poseManager.hpp"
 
 using namespace std;
@@ -35,179 +44,263 @@ class Slam {
         SlamConfig cfg;
         SP<FrameManager> fm;
         SP<LandmarkManager> lm;
-        bool initialized = false;
+        atomic<bool> initialized{false};
     protected:
+        //Declared before its users, so that it is created before them and destroyed after them
+        SP<ThreadPool> _threadPool;
         SP<Matcher> _matcher;
         SP<PoseManager> _pm;
         Ptr<ORB> _orb;//This is not used, but removing it generates build errors related to cv::FAST
         ORBextractor _orbExtractorInit;
         ORBextractor _orbExtractor;
+        //Trained offline, see load_vocabulary. Null without one.
+        SP<Vocabulary> _vocabulary;
+        //Only used by the extraction stage
+        MatchIndex _matchIndex;
+        vector<int> _words;
+        //Seeds the match index, so the trees of a frame only depend on its position in the sequence
+        unsigned _extractedFrames = 0;
+        //Published by the pose stage, read by the extraction stage
+        Mat _roiMask;
+        int _roiMaskId = -1;
+        int _roiNextMaskId = 0;
+        //Cells skipped by the last published masks, by mask id, for the frames extracted with them
+        deque<pair<int, Mat>> _roiSkippedCells;
+        mutex _roiMaskMutex;
+        //Points matched to landmarks by cell, as of the last frame that extracted the cell,
+        //and frames in a row that skipped the cell. Only used by the pose stage.
+        Mat _roiTracked;
+        Mat _roiSkips;
+        //Declared last so that the stages finish their tasks before anything they use is destroyed
+        SP<SerialExecutor> _extractStage;
+        SP<SerialExecutor> _poseStage;
 
-        void populate_match_node(vector<SP<MatchNodeInt>>& matchNodes, set<int>& kpsPending, SP<Mat> descs,
-                    int branchSize, int leafSize) {
-            int maxSize = ((int)kpsPending.size() < leafSize)? (int)kpsPending.size() : branchSize;
-            for (int index = 0; index < maxSize; index++) {
-                auto kpIndex = TransformUtils::pop_random<int>(kpsPending);
-                matchNodes.push_back(make_shared<MatchNodeInt>(kpIndex));
+        // Mask of the cells with fewer than roiMinTracked points matched to landmarks.
+        // The border cells, where new structure enters the view, are always extracted.
+        // A cell skipped by the mask frame was extracted with keeps its count from the last
+        // frame that extracted it, so cells are not skipped and extracted on alternate frames.
+        // A skipped cell still has a window of roiSparseSize at its centre extracted, and is
+        // extracted fully again after roiMaxSkips frames.
+        void update_roi_mask(SP<Frame> frame, int width, int height, int roiMaskId) {
+            const int cellSize = cfg.roiCellSize;
+            const int cols = (width + cellSize - 1)/cellSize;
+            const int rows = (height + cellSize - 1)/cellSize;
+            if (_roiTracked.rows != rows || _roiTracked.cols != cols) {
+                _roiTracked = Mat::zeros(rows, cols, CV_32S);
+                _roiSkips = Mat::zeros(rows, cols, CV_32S);
+            }
+            Mat tracked = Mat::zeros(rows, cols, CV_32S);
+            for (auto fp : frame->fps) {
+                if (fp->landmark.expired()) continue;
+                const int col = std::min(std::max((int)fp->px()/cellSize, 0), cols - 1);
+                const int row = std::min(std::max((int)fp->py()/cellSize, 0), rows - 1);
+                tracked.at<int>(row, col)++;
             }
-            if (kpsPending.size() == 0) return;
 
-            map<SP<MatchNodeInt>, set<int>> nodeKpIndices;
-            for (auto kpIndex : kpsPending) {
-                float minDistance = -1;
-                SP<MatchNodeInt> minNode = matchNodes[0];
-                for (auto childNode : matchNodes) {
-                    auto distance = norm(descs->row(kpIndex), descs->row(childNode->index), NORM_HAMMING);
-                    if (minDistance == -1 || distance < minDistance) {
-                        minDistance = distance;
-                        minNode = childNode;
-                    }
+            //Cells the frame was extracted without. A mask no longer known counts as skipping
+            //every cell, the counts are then left as they are.
+            Mat frameSkipped = Mat::zeros(rows, cols, CV_8UC1);
+            if (roiMaskId >= 0) {
+                lock_guard<mutex> lock(_roiMaskMutex);
+                frameSkipped.setTo(1);
+                for (auto& [id, skipped] : _roiSkippedCells) {
+                    if (id == roiMaskId && skipped.size() == frameSkipped.size()) skipped.copyTo(frameSkipped);
                 }
-                nodeKpIndices[minNode].insert(kpIndex);
-            }
-            for (auto& [node, kpIndices]: nodeKpIndices) {
-                populate_match_node(node->children, kpIndices, descs, branchSize, leafSize);
             }
-        }
-
-        SP<vector<vector<SP<MatchNodeInt>>>> populate_match_tree(SP<Mat> descs, int size) {
-            int leafSize = cfg.leafSize;
-            int branchSize = cfg.branchSize;
-            int treeSize = cfg.treeSize;
-            auto matchTree = make_shared<vector<vector<SP<MatchNodeInt>>>>();
 
-            for (int tree = 0; tree < treeSize; tree++) {
-                set<int> kpsPending;
-                for (int i = 0; i < size; i++) kpsPending.insert(i);
-                vector<SP<MatchNodeInt>> matchNodeVec;
-                matchTree->push_back(matchNodeVec);
-                populate_match_node((*matchTree)[tree], kpsPending, descs, branchSize, leafSize);
+            Mat skippedCells = Mat::zeros(rows, cols, CV_8UC1);
+            Mat roiMask(height, width, CV_8UC1, Scalar(255));
+            const int sparseSize = std::min(std::max(cfg.roiSparseSize, 0), cellSize);
+            for (int row = 0; row < rows; row++) {
+                for (int col = 0; col < cols; col++) {
+                    if (frameSkipped.at<uchar>(row, col)) {
+                        _roiSkips.at<int>(row, col)++;
+                    } else {
+                        _roiTracked.at<int>(row, col) = tracked.at<int>(row, col);
+                        _roiSkips.at<int>(row, col) = 0;
+                    }
+                    if (row == 0 || col == 0 || row == rows - 1 || col == cols - 1) continue;
+                    if (_roiTracked.at<int>(row, col) < cfg.roiMinTracked) continue;
+                    if (_roiSkips.at<int>(row, col) >= cfg.roiMaxSkips) continue;
+                    skippedCells.at<uchar>(row, col) = 1;
+                    Rect cell(col*cellSize, row*cellSize, cellSize, cellSize);
+                    roiMask(cell & Rect(0, 0, width, height)).setTo(0);
+                    const int offset = (cellSize - sparseSize)/2;
+                    Rect window(col*cellSize + offset, row*cellSize + offset, sparseSize, sparseSize);
+                    roiMask(window & Rect(0, 0, width, height)).setTo(255);
+                }
             }
-            return matchTree;
+            lock_guard<mutex> lock(_roiMaskMutex);
+            _roiMask = roiMask;
+            _roiMaskId = _roiNextMaskId++;
+            _roiSkippedCells.push_back(make_pair(_roiMaskId, skippedCells));
+            //Frames extracted ahead by the pipeline use one of the last masks
+            while (_roiSkippedCells.size() > 8) _roiSkippedCells.pop_front();
         }
 
-        void storeDescriptor(float* array, const cv::Mat& descriptor) {
-            CV_Assert(descriptor.type() == CV_8UC1);
-            CV_Assert(descriptor.rows == 1);
-            CV_Assert(descriptor.cols <= 32);
-
-            std::memcpy(array, descriptor.data, descriptor.cols);
+        void reset_roi_mask() {
+            _roiTracked.release();
+            _roiSkips.release();
+            lock_guard<mutex> lock(_roiMaskMutex);
+            _roiMask.release();
+            _roiMaskId = -1;
         }
 
-        // Recreate cv::Mat descriptor from a 32-bit integer array
-        void recreateDescriptor(const float* array, cv::Mat& descriptor) {
-            std::memcpy(descriptor.data, array, descriptor.cols);
+        tuple<int, Mat> get_roi_mask() {
+            lock_guard<mutex> lock(_roiMaskMutex);
+            return make_tuple(_roiMaskId, _roiMask);
         }
 
-        tuple<SP<FramePointVec>, SP<vector<vector<SP<MatchNode>>>>> extract(ExportData* data, SP<Frame> frame) {
-            auto fpVec = make_shared<FramePointVec>();
-            for (int i = 0; i < data->kpSize; i++) {
-                KeyPoint kp;
-                kp.pt = Point2f(data->x[i], data->y[i]);
-                cv::Mat descriptor(1, 32, CV_8UC1);
-                recreateDescriptor(data->desc[i], descriptor);
-                auto fp = make_shared<FramePoint>(i, 
-                    kp, descriptor, frame, cfg.cx, cfg.cy, 1);
-                fpVec->push_back(fp);
+        //Keypoints of the frame as structure of arrays, the descriptors are one contiguous matrix
+        tuple<SP<FrameKeyPoints>, SP<MatchIndex>> extract(const ExportData::View& data) {
+            const int kpSize = data.header->kpSize;
+            auto kps = make_shared<FrameKeyPoints>();
+            kps->resize(kpSize);
+            copy(data.x, data.x + kpSize, kps->px.begin());
+            copy(data.y, data.y + kpSize, kps->py.begin());
+            copy(data.octave, data.octave + kpSize, kps->octave.begin());
+            copy(data.angle, data.angle + kpSize, kps->angle.begin());
+            copy(data.word, data.word + kpSize, kps->word.begin());
+            for (int i = 0; i < kpSize; i++) {
+                kps->x[i] = data.x[i] - cfg.cx;
+                kps->y[i] = data.y[i] - cfg.cy;
             }
+            if (kpSize > 0) memcpy(kps->descs.ptr(), data.desc, (size_t)kpSize*DESC_BYTES);
 
-            auto matchTree = make_shared<vector<vector<SP<MatchNode>>>>();
-            for (int tree = 0; tree < data->treeSize; tree++) {
-                vector<SP<MatchNode>> matchNodeVec;
-                matchTree->push_back(matchNodeVec);
-                vector<SP<MatchNode>> queue;
-                int dataIndex = 0, nodeCount = 0;
-                while(data->trees[tree][dataIndex] != -1) {
-                    auto fp = (*fpVec)[data->trees[tree][dataIndex]];
-                    (*matchTree)[tree].push_back(make_shared<MatchNode>(fp));
-                    queue.push_back((*matchTree)[tree][(*matchTree)[tree].size() - 1]);
-                    nodeCount++;
-                    dataIndex++;
-                }
-                dataIndex++;
-                while (queue.size() > 0 && nodeCount < data->kpSize) {
-                    auto matchNode = queue[queue.size()-1];
-                    queue.pop_back();
-                    while(data->trees[tree][dataIndex] != -1 && nodeCount < data->kpSize) {
-                        auto fp = (*fpVec)[data->trees[tree][dataIndex]];
-                        matchNode->children.push_back(make_shared<MatchNode>(fp));
-                        queue.push_back(matchNode->children[matchNode->children.size() - 1]);
-                        nodeCount++;
-                        dataIndex++;
-                    }
-                    dataIndex++;
-                }
-            }
+            auto matchIndex = make_shared<MatchIndex>();
+            matchIndex->assign(data.treeRoots, data.header->treeSize, data.nodes, data.header->nodeSize);
 
-            return make_tuple(fpVec, matchTree);
+            return make_tuple(kps, matchIndex);
         }
 
     public:
         Slam(SlamConfig& cfgArg) : 
         cfg(cfgArg),
         fm{make_shared<FrameManager>(cfg)},
-        lm{make_shared<LandmarkManager>(cfg)},
+        lm{make_shared<LandmarkManager>(cfg, fm->covisibility)},
+        _threadPool{make_shared<ThreadPool>(cfg.numThreads)},
         _matcher{make_shared<Matcher>(cfg, lm, fm)},
-        _pm{make_shared<PoseManager>(cfg, lm, _matcher, fm)},
+        _pm{make_shared<PoseManager>(cfg, lm, _matcher, fm, _threadPool.get())},
         _orb(ORB::create()),
-        _orbExtractorInit(cfg.reqdKpsInit, 1.2, NLEVELS, 20, 7),
-        _orbExtractor(cfg.reqdKps, 1.2, NLEVELS, 20, 7) {
+        _orbExtractorInit(cfg.reqdKpsInit, 1.2, NLEVELS, 20, 7, cfg.orbAngleBins, cfg.fastThHysteresis, cfg.flatOctTree,
+            _threadPool.get()),
+        _orbExtractor(cfg.reqdKps, 1.2, NLEVELS, 20, 7, cfg.orbAngleBins, cfg.fastThHysteresis, cfg.flatOctTree,
+            _threadPool.get()),
+        _extractStage{cfg.pipelineDepth > 0? make_shared<SerialExecutor>(cfg.pipelineDepth) : nullptr},
+        _poseStage{cfg.pipelineDepth > 0? make_shared<SerialExecutor>(cfg.pipelineDepth) : nullptr} {
             cout<<"MaxGap matchers cpp "<<cfg.maxGap<<endl;
         }
 
-        void extract_keypoints (Mat& img, ExportData* data) 
+        /**
+         * @brief Queue a frame on the extraction -> pose pipeline. The frame is extracted
+         * while the previous ones are still being processed, the pose stage takes frames in
+         * submission order. onProcessed runs on the pose stage right after process, before
+         * the next frame, so it may read the Slam state. With pipelineDepth 0 both stages
+         * run on the calling thread.
+         * Extraction runs ahead of the pose stage, so a frame may be extracted before the
+         * previous frames have updated the initialization state or the extraction mask.
+         *
+         * @return future<SP<PoseManagerOutput>> Result of process for the frame
+         */
+        future<SP<PoseManagerOutput>> submit_frame(const Mat& img, const double orientation[3], int id,
+                int64_t timestamp, function<void(SP<PoseManagerOutput>)> onProcessed = nullptr) {
+            auto data = make_shared<ExportData>();
+            array<double, 3> orient{orientation[0], orientation[1], orientation[2]};
+            auto processFrame = [this, data, orient, id, timestamp, onProcessed] {
+                double frameOrientation[3] = {orient[0], orient[1], orient[2]};
+                auto result = process(frameOrientation, id, timestamp, data.get());
+                if (onProcessed) onProcessed(result);
+                return result;
+            };
+
+            if (!_poseStage) {
+                Mat frameImg = img;
+                extract_keypoints(frameImg, data.get());
+                packaged_task<SP<PoseManagerOutput>()> task(processFrame);
+                auto result = task.get_future();
+                task();
+                return result;
+            }
+
+            //The caller may reuse the image buffer once this returns
+            shared_future<void> extracted = _extractStage->submit([this, data, frameImg = img.clone()]() mutable {
+                extract_keypoints(frameImg, data.get());
+            }).share();
+            return _poseStage->submit([extracted, processFrame] {
+                extracted.get();
+                return processFrame();
+            });
+        }
+
+        /**
+         * @brief Extracts keypoints of img into data. Keypoints are only kept on the non zero
+         * pixels of mask. Without a mask, with roiExtraction after initialization, the cells
+         * well tracked on recent frames are skipped but for a sparse window, and the id of the
+         * mask used is encoded with the frame.
+         */
+        void extract_keypoints (Mat& img, ExportData* data, const Mat& mask = Mat()) 
         {
             //Extract keypoints and descriptors
             auto analysisStart = Timer::time();
             auto kps = make_shared<vector<KeyPoint>>();
             auto descs = make_shared<Mat>();
+            int roiMaskId = -1;
             if (!initialized) {
-                _orbExtractorInit(img, cv::Mat(), *kps, *descs);
+                _orbExtractorInit(img, mask, *kps, *descs);
+            } else if (mask.empty() && cfg.roiExtraction) {
+                auto [id, roiMask] = get_roi_mask();
+                if (roiMask.size() == img.size()) roiMaskId = id;
+                else roiMask = Mat();
+                _orbExtractor(img, roiMask, *kps, *descs);
             } else {
-                _orbExtractor(img, cv::Mat(), *kps, *descs);
+                _orbExtractor(img, mask, *kps, *descs);
             }
-            data->imgWidth = img.size().width;
-            data->imgHeight = img.size().height;
-
             auto kpTime = Timer::time() - (analysisStart);
             analysisStart = Timer::time();
            
-            auto matchTree = populate_match_tree(descs, kps->size());
+            //With a vocabulary every keypoint is quantized by one descent of the tree
+            //instead of building the random match trees
+            if (_vocabulary) {
+                _words.resize(descs->rows);
+                for (int i = 0; i < descs->rows; i++) _words[i] = _vocabulary->lookup(descs->ptr(i));
+                _matchIndex.build(*descs, 0, cfg.branchSize, cfg.leafSize, _extractedFrames);
+            } else {
+                _matchIndex.build(*descs, cfg.treeSize, cfg.branchSize, cfg.leafSize, _extractedFrames);
+            }
+            _extractedFrames++;
             auto treeCreateTime = Timer::time() - (analysisStart);
             cout<<"KP Time "<<kpTime<<" Tree time "<<treeCreateTime<<endl;
             
-            data->kpSize = (float)kps->size();
-            for (int i = 0; i < (int)kps->size(); i++) data->x[i] = (*kps)[i].pt.x;
-            for (int i = 0; i < (int)kps->size(); i++) data->y[i] = (*kps)[i].pt.y;
-            for (int i = 0; i < (int)kps->size(); i++) {
-                storeDescriptor(data->desc[i], descs->row(i));
-            }
-            data->treeSize = (float)matchTree->size();
-            for (int tree = 0; tree < (int)matchTree->size(); tree++) {
-                vector<SP<MatchNodeInt>> queue;
-                int index = 0;
-                for (int i = 0; i < (int)(*matchTree)[tree].size(); i++) {
-                    data->trees[tree][index++] = (*matchTree)[tree][i]->index;
-                    queue.push_back((*matchTree)[tree][i]);
-                }
-                data->trees[tree][index++] = -1;
-                while(queue.size() > 0) {
-                    auto matchNode = queue[queue.size()-1];
-                    queue.pop_back();
-                    if (matchNode->children.size() > 0) {
-                        for (int childIndex = 0; childIndex < (int)matchNode->children.size(); childIndex++) {
-                            data->trees[tree][index++] = matchNode->children[childIndex]->index;
-                            queue.push_back(matchNode->children[childIndex]);
-                        }
-                    }
-                    data->trees[tree][index++] = -1;
-                }
-                data->trees[tree][index++] = -2;
-            }
+            data->encode(img.size().width, img.size().height, *kps, *descs, 
+                _vocabulary? _words.data() : nullptr, _matchIndex, roiMaskId);
+        }
+
+        /**
+         * @brief Load a vocabulary trained offline by vocabularyTrainer. Keypoints are then
+         * matched by vocabulary node and the keyframe bags of words use it. Load it before
+         * the first frame.
+         *
+         * @param in Binary stream
+         * @return bool False if in does not hold a vocabulary
+         */
+        bool load_vocabulary(istream& in) {
+            auto vocabulary = make_shared<Vocabulary>();
+            if (!vocabulary->load(in)) return false;
+            _vocabulary = vocabulary;
+            fm->set_vocabulary(vocabulary);
+            return true;
+        }
+
+        SP<PoseManagerOutput> process(double orientation[3], int id, int64_t timestamp, ExportData* data) {
+            return process(orientation, id, timestamp, data->bytes.data());
         }
 
-        SP<PoseManagerOutput> process(double orientation[3], int id, int64_t timestamp, ExportData* data)
+        /**
+         * @brief Estimate the pose of a frame from its encoded ExportData buffer
+         */
+        SP<PoseManagerOutput> process(double orientation[3], int id, int64_t timestamp, const uchar* encoded)
         {
+            auto data = ExportData::decode(encoded);
             //Extract keypoints and descriptors
             auto addStart = Timer::time();
             auto analysisStart = Timer::time();
@@ -218,9 +311,9 @@ class Slam {
            
             //Create frame 
             // auto frameStart = Timer::time();
-            auto [fpVec, matchTree] = extract(data, nullptr);
+            auto [kps, matchIndex] = extract(data);
             auto currFrame = fm->create_frame(
-                frameId, data->imgWidth, data->imgHeight, orientation, timestamp, fpVec, matchTree);
+                frameId, data.header->imgWidth, data.header->imgHeight, orientation, timestamp, kps, matchIndex);
             // cout<<currFrame->id<<": Time FrameInsert: "<<Timer::diff(frameStart)<<endl;
             auto frameCreatTime = Timer::time() - (analysisStart);
             analysisStart = Timer::time();
@@ -259,6 +352,15 @@ class Slam {
                 if (_pm->is_initialized()) initialized = true;
             }
 
+            //Extract everywhere again once tracking is lost
+            if (cfg.roiExtraction) {
+                if (initialized && result && result->valid) {
+                    update_roi_mask(currFrame, data.header->imgWidth, data.header->imgHeight, data.header->roiMaskId);
+                } else {
+                    reset_roi_mask();
+                }
+            }
+
             result->profile[FRAME_CREATE_TIME] = frameCreatTime;
             result->profile[POSE_TIME] = poseTime;
             result->profile[OVERALL_TIME] = Timer::time() - addStart;
@@ -10,6 +10,7 @@
  */
 #include <iostream>
 #include <fstream>
+#include <deque>
 
 #include "slam/slam.hpp"
 #include "utils/configReader.hpp"
@@ -90,7 +91,7 @@ void debug_frame(SlamConfig& _cfg,
     //         } else {
     //             file<<";LID="<<-1;
     //         }
-    //         file<<";X="<<fp->kp.pt.x<<";Y="<<fp->kp.pt.y<<endl;
+    //         file<<";X="<<fp->px()<<";Y="<<fp->py()<<endl;
     //     }
     //     file<<"KPS_END:FID="<<currFrame->id<<endl;
     // }
@@ -214,7 +215,7 @@ void debug_frame(SlamConfig& _cfg,
                             file<<";BEHIND="<<fpValid->isBehind<<";CLOSE="<<fpValid->isTooClose<<";FAR="<<fpValid->isTooFar;
                             file<<";PX="<<fpValid->px*slam.cfg.fx+slam.cfg.cx;
                             file<<";PY="<<fpValid->py*slam.cfg.fx+slam.cfg.cy;
-                            file<<";X="<<fp->kp.pt.x<<";Y="<<fp->kp.pt.y;
+                            file<<";X="<<fp->px()<<";Y="<<fp->py();
                             file<<endl;
                         }
                     }
@@ -281,6 +282,18 @@ int main( int argc, char** argv )
 
     SlamConfig _cfg{&configReader};
     Slam slam(_cfg);
+    string vocabularyName = configReader.read_s("vocabulary");
+    if (!vocabularyName.empty()) {
+        ifstream vocabularyFile(vocabularyName, ios::binary);
+        if (!slam.load_vocabulary(vocabularyFile)) {
+            cout<<"Could not load vocabulary "<<vocabularyName<<endl;
+            return 1;
+        }
+    }
+    //Descriptors of every frame for vocabularyTrainer
+    string dumpName = configReader.read_s("descriptorDump");
+    ofstream dumpFile;
+    if (!dumpName.empty()) dumpFile.open(dumpName, ios::binary);
     string debugFilename = "debug/logs/debug.txt";
     ofstream debugFile = ofstream(debugFilename);
 
@@ -291,34 +304,11 @@ int main( int argc, char** argv )
     
     debugFile<<"LIMITS:START="<<pathStart<<";END="<<pathEnd<<";MULTIPLIER="<<1
             <<";OFFSETX="<<0<<";OFFSETY="<<0<<endl;
-    for (int pathIdx = pathStart; pathIdx <= pathEnd; pathIdx+=offset) {
-        stringstream pathName;
-        stringstream orientName;
-        pathName << pathStr << pathIdx <<"."<<configReader.read_s("fileExtension");
-        orientName << orientStr << pathIdx << ".txt";
-        cout<<"##"<<endl<<"##   ============================="<<endl;
-        cout << "##"<<pathName.str()<<endl;
-
-        auto imgColor = imread(pathName.str());
-        Mat img;
-        // auto img = make_shared<Mat>();
-        cvtColor(imgColor, img, COLOR_BGR2GRAY);
-        // auto img = make_shared<Mat>(imread(pathName.str()));
-        if (pathIdx == pathStart) {
-            debugFile<<"IMG_DIMS:WIDTH="<<img.cols<<";HEIGHT="<<img.rows<<endl;
-        }
 
-        double orientation[3];
-        orientation[0] = 0;
-        orientation[1] = 0;
-        orientation[2] = 0;
-        read_orientation(orientation, orientName.str());
-        
-        timer.start();
-        ExportData data;
-        slam.extract_keypoints(img, &data);
-        auto result = slam.process(orientation, pathIdx, Timer::time(), &data);
+    //With pipelineDepth this runs on the pose stage, one frame at a time in frame order
+    auto handle_result = [&](SP<PoseManagerOutput> result, const string& pathName) {
         auto currFrame = result->frame;
+        if (dumpFile.is_open()) Vocabulary::write_dump(dumpFile, currFrame->kps.descs);
         cout<<"Overall Landmarks Size "<<slam.lm->get_landmarks()->size()<<" Key Frames size "<<slam.fm->get_keyframes()->size()<<endl;
         
         if (!result->valid) {
@@ -326,7 +316,7 @@ int main( int argc, char** argv )
             cout<<currFrame->id<<" Bad Frame... Moving on to next "<<badFrameCount<<endl;
         } else {
             goodFrameCount++;
-            timer.stop();
+            if (_cfg.pipelineDepth == 0) timer.stop();
         }
 
         //Print frames
@@ -342,9 +332,55 @@ int main( int argc, char** argv )
                 print_pose(slam.fm->get_current(), cout, slam);
             }
         }
-        debug_frame(_cfg, debugFile, pathName.str(), result, slam.fm->originFrame, slam);
+        debug_frame(_cfg, debugFile, pathName, result, slam.fm->originFrame, slam);
         cout<<endl<<endl; 
+    };
+
+    deque<future<SP<PoseManagerOutput>>> pipelinedFrames;
+    for (int pathIdx = pathStart; pathIdx <= pathEnd; pathIdx+=offset) {
+        stringstream pathName;
+        stringstream orientName;
+        pathName << pathStr << pathIdx <<"."<<configReader.read_s("fileExtension");
+        orientName << orientStr << pathIdx << ".txt";
+        cout<<"##"<<endl<<"##   ============================="<<endl;
+        cout << "##"<<pathName.str()<<endl;
+
+        auto imgColor = imread(pathName.str());
+        Mat img;
+        // auto img = make_shared<Mat>();
+        cvtColor(imgColor, img, COLOR_BGR2GRAY);
+        // auto img = make_shared<Mat>(imread(pathName.str()));
+        if (pathIdx == pathStart) {
+            debugFile<<"IMG_DIMS:WIDTH="<<img.cols<<";HEIGHT="<<img.rows<<endl;
+        }
+
+        double orientation[3];
+        orientation[0] = 0;
+        orientation[1] = 0;
+        orientation[2] = 0;
+        read_orientation(orientation, orientName.str());
+        
+        if (_cfg.pipelineDepth > 0) {
+            string name = pathName.str();
+            pipelinedFrames.push_back(slam.submit_frame(img, orientation, pathIdx, Timer::time(),
+                [&handle_result, name](SP<PoseManagerOutput> result) { handle_result(result, name); }));
+            //Release the results of processed frames, rethrowing their errors
+            while (!pipelinedFrames.empty() &&
+                    pipelinedFrames.front().wait_for(chrono::seconds(0)) == future_status::ready) {
+                pipelinedFrames.front().get();
+                pipelinedFrames.pop_front();
+            }
+        } else {
+            timer.start();
+            ExportData data;
+            slam.extract_keypoints(img, &data);
+            auto result = slam.process(orientation, pathIdx, Timer::time(), &data);
+            handle_result(result, pathName.str());
+        }
     }
+    for (auto& frame : pipelinedFrames) frame.get();
+    //Frames overlap when pipelined, so the per frame time is the overall throughput
+    if (_cfg.pipelineDepth > 0) timer._total = Timer::time() - startTimer;
     
     cout<<endl<<endl;
     cout<<"Bad Frame Count "<<badFrameCount<<" Total time "<<Timer::diff(startTimer)<<" Per Frame time "<<timer.print(timer._total/goodFrameCount)<<endl;
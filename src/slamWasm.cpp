@@ -8,6 +8,7 @@
  * @copyright Copyright (c) 2023
  * 
  */
+#include <sstream>
 #include "emscripten.h"
 #include "slam/slam.hpp"
 #include "utils/configReader.hpp"
@@ -32,6 +33,14 @@ extern "C" {
         return new Slam(_cfg);
     }
 
+    //data holds a vocabulary written by vocabularyTrainer, e.g. copied into memory from
+    //allocateMemory. Returns 1 if it was loaded.
+    EMSCRIPTEN_KEEPALIVE
+    int load_vocabulary(Slam* slam, const char* data, int size) {
+        istringstream in(string(data, size));
+        return slam->load_vocabulary(in)? 1 : 0;
+    }
+
     EMSCRIPTEN_KEEPALIVE 
     unsigned* create_image_buffer(int width, int height) {
         return new unsigned[width*height*2];
@@ -39,25 +48,33 @@ extern "C" {
     }
 
     EMSCRIPTEN_KEEPALIVE 
-    float* create_data_buffer() {
-        return (float*)new ExportData;
+    int get_data_buffer_size() {
+        return ExportData::max_size()/sizeof(float);
     }
 
     EMSCRIPTEN_KEEPALIVE 
-    int get_data_buffer_size() {
-        return sizeof(ExportData)/sizeof(float);
+    float* create_data_buffer() {
+        return new float[get_data_buffer_size()];
     }
 
+    //Returns the number of floats of data holding the frame, only those need to be
+    //transferred to the pose worker. -1 if the frame does not fit the buffer.
     EMSCRIPTEN_KEEPALIVE 
     int extract_keypoints(Slam* slam, const unsigned* imgData, int height, int width, float* data) {
         auto colorMat = Mat(height, width, CV_8UC4, (unsigned*)imgData);
         // SP<Mat> greyMat = make_shared<Mat>();
         Mat greyMat;
         cvtColor(colorMat, greyMat, COLOR_RGBA2GRAY);
-        slam->extract_keypoints(greyMat, (ExportData*)data);
-        ExportData* dataptr = (ExportData*)data;
-        std::cout<<"Data WASM "<<dataptr->imgWidth<<", "<<dataptr->imgHeight<<", "<<dataptr->kpSize<<endl;
-        return 0;
+        ExportData exportData;
+        slam->extract_keypoints(greyMat, &exportData);
+        auto header = ExportData::decode(exportData.bytes.data()).header;
+        std::cout<<"Data WASM "<<header->imgWidth<<", "<<header->imgHeight<<", "<<header->kpSize<<endl;
+        if (exportData.bytes.size() > ExportData::max_size()) {
+            cout<<"Frame data of "<<exportData.bytes.size()<<" bytes exceeds the data buffer"<<endl;
+            return -1;
+        }
+        memcpy(data, exportData.bytes.data(), exportData.bytes.size());
+        return exportData.bytes.size()/sizeof(float);
     }
 
     EMSCRIPTEN_KEEPALIVE 
@@ -66,8 +83,7 @@ extern "C" {
         orientation[0] = x;
         orientation[1] = y;
         orientation[2] = z;
-        ExportData* dataptr = (ExportData*)data;
-        auto result = slam->process(orientation, -1, timestamp, (ExportData*)data);
+        auto result = slam->process(orientation, -1, timestamp, (const uchar*)data);
         // cout<<"Overall Landmarks Size "<<slam->lm->get_landmarks()->size()<<endl;
         if (result && result->valid) {
             auto currFrame = result->frame;
@@ -100,7 +116,7 @@ extern "C" {
 
     EMSCRIPTEN_KEEPALIVE 
     int process_image(Slam* slam, const unsigned* imgData, int height, int width, float* data, float x, float y, float z, int64_t timestamp) {
-        extract_keypoints(slam, imgData, height, width, data);
+        if (extract_keypoints(slam, imgData, height, width, data) < 0) return DEFAULT;
         return process_keypoints(slam, data, x, y, z, timestamp);
     }
 
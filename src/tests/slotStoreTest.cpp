@@ -0,0 +1,185 @@
+/**
+ * @file slotStoreTest.cpp
+ * @brief Behavior tests of SlotSet and SlotMap: insert, erase, merge of a range and erase
+ * while iterating, with and without the slot bitset, on the heap and on a FrameArena.
+ * Run by ctest, exits with the number of failed checks.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <iostream>
+#include <vector>
+#include <memory>
+
+#include "../utils/slotStore.hpp"
+
+using namespace std;
+
+struct Item : public Slotted<Item> {
+    int value;
+    Item(int valueArg) : value(valueArg) {}
+};
+using ItemVec = vector<shared_ptr<Item>>;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        cout<<__FILE__<<":"<<__LINE__<<": "<<#cond<<" failed"<<endl; \
+        failures++; \
+    }
+
+static ItemVec make_items(int n) {
+    ItemVec items;
+    for (int i = 0; i < n; i++) items.push_back(make_shared<Item>(i));
+    return items;
+}
+
+//Members in increasing slot order, and count() agreeing with them
+template <typename S> static bool consistent(const S& set, const ItemVec& all) {
+    int last = -1;
+    size_t members = 0;
+    for (auto& item : set) {
+        if (item->slot() <= last) return false;
+        last = item->slot();
+    }
+    for (auto& item : all) members += set.count(item);
+    return members == set.size();
+}
+
+template <bool Bits> static void test_insert(FrameArena* arena) {
+    auto items = make_items(100);
+    SlotSet<Item, Bits> set(arena);
+    //Out of slot order, with duplicates
+    for (int i = 99; i >= 0; i -= 3) CHECK(set.insert(items[i]).second);
+    for (int i = 0; i < 100; i += 2) set.insert(items[i]);
+    CHECK(!set.insert(items[99]).second);
+    CHECK(consistent(set, items));
+    for (int i = 0; i < 100; i++) {
+        bool member = i % 2 == 0 || (99 - i) % 3 == 0;
+        CHECK(set.count(items[i]) == (member? 1u : 0u));
+        CHECK((set.find(items[i]) != set.end()) == member);
+        if (member) CHECK(*set.find(items[i]) == items[i]);
+    }
+}
+
+template <bool Bits> static void test_erase(FrameArena* arena) {
+    auto items = make_items(100);
+    SlotSet<Item, Bits> set(arena);
+    set.insert(items.begin(), items.end());
+    for (int i = 0; i < 100; i += 3) CHECK(set.erase(items[i]) == 1);
+    for (int i = 0; i < 100; i += 3) CHECK(set.erase(items[i]) == 0);
+    CHECK(set.size() == 66);
+    CHECK(consistent(set, items));
+    for (int i = 0; i < 100; i++) CHECK(set.count(items[i]) == (i % 3 == 0? 0u : 1u));
+    //Erased members go back in their place
+    set.insert(items[30]);
+    CHECK(set.count(items[30]) == 1);
+    CHECK(consistent(set, items));
+    set.clear();
+    CHECK(set.empty());
+    for (auto& item : items) CHECK(set.count(item) == 0);
+}
+
+template <bool Bits> static void test_merge(FrameArena* arena) {
+    auto items = make_items(200);
+    SlotSet<Item, Bits> set(arena);
+    for (int i = 0; i < 200; i += 2) set.insert(items[i]);
+    //A range overlapping the members, out of order and with repeats
+    ItemVec range;
+    for (int i = 199; i >= 0; i -= 5) range.push_back(items[i]);
+    for (int i = 0; i < 200; i += 4) range.push_back(items[i]);
+    range.push_back(items[7]);
+    set.insert(range.begin(), range.end());
+    CHECK(consistent(set, items));
+    size_t expected = 0;
+    for (int i = 0; i < 200; i++) {
+        bool member = i % 2 == 0 || (199 - i) % 5 == 0 || i == 7;
+        expected += member;
+        CHECK(set.count(items[i]) == (member? 1u : 0u));
+    }
+    CHECK(set.size() == expected);
+
+    //Constructed from a range, and merging into an empty set
+    SlotSet<Item, Bits> copy(range.begin(), range.end());
+    CHECK(consistent(copy, items));
+    SlotSet<Item, Bits> empty(arena);
+    empty.insert(copy.begin(), copy.end());
+    CHECK(empty.size() == copy.size());
+    CHECK(consistent(empty, items));
+}
+
+template <bool Bits> static void test_erase_iterating(FrameArena* arena) {
+    auto items = make_items(100);
+    SlotSet<Item, Bits> set(arena);
+    set.insert(items.begin(), items.end());
+    for (auto it = set.begin(); it != set.end();) {
+        if ((*it)->value % 4 != 1) it = set.erase(it);
+        else ++it;
+    }
+    CHECK(set.size() == 25);
+    CHECK(consistent(set, items));
+    for (int i = 0; i < 100; i++) CHECK(set.count(items[i]) == (i % 4 == 1? 1u : 0u));
+    for (auto it = set.begin(); it != set.end();) it = set.erase(it);
+    CHECK(set.empty());
+    for (auto& item : items) CHECK(set.count(item) == 0);
+}
+
+template <bool Bits> static void test_map(FrameArena* arena) {
+    auto items = make_items(50);
+    SlotMap<Item, SlotSet<Item, Bits>, Bits> map(arena);
+    for (int i = 49; i >= 0; i -= 2) map[items[i]].insert(items[(i + 1) % 50]);
+    for (int i = 0; i < 50; i += 7) map[items[i]].insert(items[i]);
+    int last = -1;
+    for (auto& [key, values] : map) {
+        CHECK(key->slot() > last);
+        last = key->slot();
+        CHECK(values.arena() == arena);
+    }
+    for (int i = 0; i < 50; i++) {
+        bool odd = i % 2 == 1, seventh = i % 7 == 0;
+        CHECK(map.count(items[i]) == (odd || seventh? 1u : 0u));
+        if (odd) CHECK(map.at(items[i]).count(items[(i + 1) % 50]) == 1);
+        if (seventh) CHECK(map.at(items[i]).count(items[i]) == 1);
+    }
+    for (auto it = map.begin(); it != map.end();) {
+        if (it->first->value % 2 == 1) it = map.erase(it);
+        else ++it;
+    }
+    for (int i = 0; i < 50; i++) CHECK(map.count(items[i]) == (i % 2 == 0 && i % 7 == 0? 1u : 0u));
+}
+
+//Slots of destroyed items are reused, lowest first
+static void test_slots() {
+    auto items = make_items(10);
+    int slot3 = items[3]->slot(), slot6 = items[6]->slot();
+    items[6].reset();
+    items[3].reset();
+    auto first = make_shared<Item>(0);
+    auto second = make_shared<Item>(0);
+    CHECK(first->slot() == min(slot3, slot6));
+    CHECK(second->slot() == max(slot3, slot6));
+}
+
+template <bool Bits> static void test_all(FrameArena* arena) {
+    test_insert<Bits>(arena);
+    test_erase<Bits>(arena);
+    test_merge<Bits>(arena);
+    test_erase_iterating<Bits>(arena);
+    test_map<Bits>(arena);
+}
+
+int main()
+{
+    FrameArena arena(1024);
+    test_all<true>(nullptr);
+    test_all<false>(nullptr);
+    test_all<true>(&arena);
+    test_all<false>(&arena);
+    test_slots();
+    if (failures == 0) cout<<"All slot store checks passed"<<endl;
+    return failures;
+}
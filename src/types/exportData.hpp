@@ -0,0 +1,143 @@
+/**
+ * @file exportData.hpp
+ * @brief Keypoints, descriptors and match index of a frame packed in one byte buffer.
+ * The extraction stage writes it and the pose stage reads it, possibly in another
+ * worker after a copy, so the buffer is only as long as the frame needs.
+ * Layout of version 5, every section starts 4 byte aligned:
+ * ExportDataHeader | float x[kpSize] | float y[kpSize] | int octave[kpSize] | float angle[kpSize] |
+ * int word[kpSize] | uchar desc[kpSize][DESC_BYTES] | int treeRoots[treeSize] | MatchIndexNode nodes[nodeSize]
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __EXPORT_DATA_HPP__
+#define __EXPORT_DATA_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "../utils/matchIndex.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define EXPORT_DATA_VERSION 5
+//Capacity of the fixed buffers shared with JS
+#define MAX_KPS 1500
+#define MAX_TREES 5
+
+struct ExportDataHeader {
+    int32_t version;
+    int32_t byteSize;   //Whole buffer, header included
+    float imgWidth;
+    float imgHeight;
+    int32_t kpSize;
+    int32_t treeSize;
+    int32_t nodeSize;
+    int32_t roiMaskId;  //Region of interest mask the keypoints were extracted with, -1 for none
+};
+static_assert(sizeof(ExportDataHeader) % 4 == 0 && sizeof(MatchIndexNode) % 4 == 0,
+    "ExportData is transferred as a float buffer");
+
+class ExportData {
+    public:
+        vector<uchar> bytes;
+
+        //Sections of an encoded buffer. Points into the buffer, nothing is copied.
+        struct View {
+            const ExportDataHeader* header;
+            const float* x;
+            const float* y;
+            const int* octave;
+            const float* angle;
+            const int* word;
+            const uchar* desc;
+            const int* treeRoots;
+            const MatchIndexNode* nodes;
+        };
+
+        static size_t encoded_size(int kpSize, int treeSize, int nodeSize) {
+            return sizeof(ExportDataHeader) + (size_t)kpSize*(3*sizeof(float) + 2*sizeof(int) + DESC_BYTES) +
+                (size_t)treeSize*sizeof(int) + (size_t)nodeSize*sizeof(MatchIndexNode);
+        }
+
+        //Size of a buffer that holds any frame of up to MAX_KPS keypoints
+        static size_t max_size() {
+            return encoded_size(MAX_KPS, MAX_TREES, MAX_TREES*(MAX_KPS + 1));
+        }
+
+        /**
+         * @brief Encode a frame into bytes, sized to fit exactly
+         *
+         * @param imgWidth
+         * @param imgHeight
+         * @param kps
+         * @param descs kps.size() x DESC_BYTES CV_8UC1 continuous descriptor matrix
+         * @param words Vocabulary word of every keypoint, null without a vocabulary
+         * @param index Match index over the rows of descs
+         * @param roiMaskId Region of interest mask the keypoints were extracted with, -1 for none
+         */
+        void encode(float imgWidth, float imgHeight, const vector<KeyPoint>& kps, const Mat& descs,
+                const int* words, const MatchIndex& index, int roiMaskId = -1) {
+            const int kpSize = (int)kps.size();
+            CV_Assert(descs.rows == kpSize && (kpSize == 0 || (descs.cols == DESC_BYTES && descs.isContinuous())));
+            const int treeSize = index.tree_count();
+            const int nodeSize = (int)index.nodes.size();
+            bytes.resize(encoded_size(kpSize, treeSize, nodeSize));
+
+            auto header = (ExportDataHeader*)bytes.data();
+            header->version = EXPORT_DATA_VERSION;
+            header->byteSize = (int32_t)bytes.size();
+            header->imgWidth = imgWidth;
+            header->imgHeight = imgHeight;
+            header->kpSize = kpSize;
+            header->treeSize = treeSize;
+            header->nodeSize = nodeSize;
+            header->roiMaskId = roiMaskId;
+
+            auto view = decode(bytes.data());
+            auto x = const_cast<float*>(view.x);
+            auto y = const_cast<float*>(view.y);
+            auto octave = const_cast<int*>(view.octave);
+            auto angle = const_cast<float*>(view.angle);
+            auto word = const_cast<int*>(view.word);
+            for (int i = 0; i < kpSize; i++) {
+                x[i] = kps[i].pt.x;
+                y[i] = kps[i].pt.y;
+                octave[i] = kps[i].octave;
+                angle[i] = kps[i].angle;
+                word[i] = words? words[i] : -1;
+            }
+            if (kpSize > 0) memcpy(const_cast<uchar*>(view.desc), descs.ptr(), (size_t)kpSize*DESC_BYTES);
+            memcpy(const_cast<int*>(view.treeRoots), index.treeRoots.data(), treeSize*sizeof(int));
+            memcpy(const_cast<MatchIndexNode*>(view.nodes), index.nodes.data(), nodeSize*sizeof(MatchIndexNode));
+        }
+
+        /**
+         * @brief Sections of an encoded buffer. Fails on a buffer of another version.
+         *
+         * @param data
+         * @return View
+         */
+        static View decode(const uchar* data) {
+            View view;
+            view.header = (const ExportDataHeader*)data;
+            CV_Assert(view.header->version == EXPORT_DATA_VERSION);
+            const int kpSize = view.header->kpSize;
+            view.x = (const float*)(data + sizeof(ExportDataHeader));
+            view.y = view.x + kpSize;
+            view.octave = (const int*)(view.y + kpSize);
+            view.angle = (const float*)(view.octave + kpSize);
+            view.word = (const int*)(view.angle + kpSize);
+            view.desc = (const uchar*)(view.word + kpSize);
+            view.treeRoots = (const int*)(view.desc + (size_t)kpSize*DESC_BYTES);
+            view.nodes = (const MatchIndexNode*)(view.treeRoots + view.header->treeSize);
+            return view;
+        }
+};
+
+#endif /* __EXPORT_DATA_HPP__ */
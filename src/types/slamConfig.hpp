@@ -11,6 +11,7 @@
 #ifndef __SLAM_CONFIG_HPP__
 #define __SLAM_CONFIG_HPP__
 
+#include <stdexcept>
 #include "../utils/configReader.hpp"
 
 #define SET(TYPE, VAR) TYPE VAR = cfg->read_##TYPE(#VAR)
@@ -28,17 +29,31 @@ class SlamConfig {
         SET(int, maxDepth);
 
         SET(bool, matchHierarchy);
+        SET(bool, matchMultiIndex);
         SET(int, leafSize);
         SET(int, branchSize);
         SET(int, treeSize);
+        SET(int, matchChecks);
 
         //KP config
         SET(int, reqdKpsInit);
         SET(int, reqdKps);
+        SET(int, orbAngleBins);
+        SET(int, fastThHysteresis);
+        SET(bool, flatOctTree);
+        SET(bool, roiExtraction);
+        SET(int, roiCellSize);
+        SET(int, roiMinTracked);
+        SET(int, roiSparseSize);
+        SET(int, roiMaxSkips);
+        SET(int, numThreads);
+        SET(int, pipelineDepth);
 
         //Matcher config
         SET(int, maxGap);
         SET(int, minGap);
+        SET(int, matchGridCell);
+        SET(int, vocabMatchLevel);
         SET(float, minAvgGapInit);
         SET(float, minAvgGap);
         SET(double, distanceThreshold);
@@ -51,6 +66,10 @@ class SlamConfig {
         SET(int, maxFrames);
         SET(int, mapInitializationFrames);
         SET(int, numKeyFrameMatches);
+        SET(int, bowCandidates);
+        SET(int, covisibleCandidates);
+        SET(int, vocabBranchSize);
+        SET(int, vocabDepth);
         SET(float, maxDistRatio);
         SET(float, maxAngle);
         SET(bool, copyRotation);
@@ -63,7 +82,11 @@ class SlamConfig {
         SET(float, smootheningTolerance);
         SET(bool, cholmod);
 
-        SlamConfig(ConfigReader* cfgArg) : cfg(cfgArg) {}
+        SlamConfig(ConfigReader* cfgArg) : cfg(cfgArg) {
+            //Cell sizes the image is divided by
+            if (matchGridCell <= 0) throw invalid_argument("matchGridCell must be positive");
+            if (roiCellSize <= 0) throw invalid_argument("roiCellSize must be positive");
+        }
 };
 
 #endif /* __SLAM_CONFIG_HPP__ */
\ No newline at end of file
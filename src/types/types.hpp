@@ -4,9 +4,11 @@
  * The key types are:
  * 1. Frame : Holds the data extracted from Image frames. Primarily contains a list of framePoints.
  * 2. FramePoint (FramePointTemplate): This represents a keypoint that has been identified in an image. 
- *      Primarily holds the u,v/x,y pixel coordinates of the keypoint in the image.
+ *      A handle to the keypoint's index in the frame's keypoint arrays (FrameKeyPoints), which hold
+ *      the u,v/x,y pixel coordinates and the descriptor of the keypoint in the image.
  * 3. Landmark (LandmarkTemplate): This holds a set of related or matched framepoints belonging to different frames. 
  *      Ideally it should not contain 2 framepoints related to the same frame.
+ * All three take a slot (see slotStore.hpp), and the sets and maps of them are slot stores.
  * 
  * The other key types are the result classes for:
  * 1. Estimate Validator: Contains the validation results of the landmarks, frames and framepoints used for BA
@@ -32,6 +34,11 @@
 #include <map>
 
 #include "slamConfig.hpp"
+#include "../utils/matchIndex.hpp"
+#include "../utils/keyPointGrid.hpp"
+#include "../utils/multiIndexHash.hpp"
+#include "../utils/vocabulary.hpp"
+#include "../utils/slotStore.hpp"
 
 using namespace std;
 using namespace cv;
@@ -41,19 +48,30 @@ using namespace Eigen;
 #define WP weak_ptr
 
 //Core Types
-template <typename T> class LandmarkTemplate {
+//Slot stores without a bitset: a landmark only has a few points, out of every point of the map
+template <typename T> using PointSet = SlotSet<T, false>;
+
+//The slot is taken together with the id, see LandmarkManager::assign_id
+template <typename T> class LandmarkTemplate : public Slotted<LandmarkTemplate<T>> {
     public:
         int id;
-        set<SP<T>> fps;
+        PointSet<T> fps;
+        //Representative descriptor, the descriptor of fps with the least median distance to the
+        //others. LandmarkManager updates it whenever fps change.
+        uchar desc[DESC_BYTES] = {0};
+        //fps changed since desc was set
+        bool descStale = true;
         Vector3d trans{0, 0, 0};
         int baIterCount = 0;
         bool valid = false;
+
+        LandmarkTemplate() : Slotted<LandmarkTemplate<T>>(false) {}
 };
 class Frame;
 template <typename T> class FramePointTemplate;
 using FramePoint = FramePointTemplate<Frame>;
 using Landmark = LandmarkTemplate<FramePoint>;
-using LandmarkSet = set<SP<Landmark>>;
+using LandmarkSet = SlotSet<Landmark>;
 using LandmarkVec = vector<SP<Landmark>>;
 using LandmarkPair = pair<SP<Landmark>, SP<Landmark>>;
 using LandmarkPairVec = vector<LandmarkPair>;
@@ -61,27 +79,54 @@ using LandmarkPairVec = vector<LandmarkPair>;
 #define INITIAL_DISTANCE 99999
 #define NLEVELS 6 //8
 using DESC = vector<Mat>;
-template <typename T> class FramePointTemplate {
+//Keypoints of a frame as structure of arrays, index i is the frame point with id i
+class FrameKeyPoints {
     public:
-        const int id;
-        KeyPoint kp;
-        float x;
-        float y;
-        Mat desc;
+        vector<float> px; //Pixel coordinates
+        vector<float> py;
+        vector<float> x; //Coordinates relative to the principal point
+        vector<float> y;
+        vector<int> octave;
+        vector<float> angle;
+        vector<int> word; //Word in the loaded vocabulary, -1 without one
+        Mat descs; //N x DESC_BYTES CV_8UC1, row i is the descriptor of keypoint i
+
+        int size() const { return (int)px.size(); }
+
+        const uchar* desc(int i) const { return descs.ptr(i); }
+
+        void resize(int n) {
+            px.resize(n);
+            py.resize(n);
+            x.resize(n);
+            y.resize(n);
+            octave.resize(n);
+            angle.resize(n);
+            word.resize(n);
+            descs.create(n, DESC_BYTES, CV_8UC1);
+        }
+};
+
+template <typename T> class FramePointTemplate : public Slotted<FramePointTemplate<T>> {
+    public:
+        const int id; //Index in the keypoint arrays of frame
         SP<T> frame;
         WP<Landmark> landmark;
         double matchDistance = INITIAL_DISTANCE;
         // bool valid = false;
 
-        FramePointTemplate(int idArg, KeyPoint& kpArg, Mat& descArg, SP<Frame> frameArg, float cx, float cy, float focal):
-            id(idArg), kp(kpArg), desc(descArg), frame(frameArg) {
-            x = (kpArg.pt.x - cx)/focal;
-            y = (kpArg.pt.y - cy)/focal;
-            // cout<<"KP "<<kp.pt.x<<" "<<kp.pt.y<<endl;
-        }
+        FramePointTemplate(int idArg, SP<T> frameArg): id(idArg), frame(frameArg) {}
+
+        float x() const { return frame->kps.x[id]; }
+        float y() const { return frame->kps.y[id]; }
+        float px() const { return frame->kps.px[id]; }
+        float py() const { return frame->kps.py[id]; }
+        int octave() const { return frame->kps.octave[id]; }
+        float angle() const { return frame->kps.angle[id]; }
+        const uchar* desc() const { return frame->kps.desc(id); }
 };
 
-using FramePointSet = set<SP<FramePoint>>;
+using FramePointSet = PointSet<FramePoint>;
 using FramePointVec = vector<SP<FramePoint>>;
 
 class Pose {
@@ -111,29 +156,7 @@ class Pose {
         }
 };
 
-class MatchNode;
-using MatchNodeVec = vector<SP<MatchNode>>;
-
-class MatchNode {
-    public:
-        SP<FramePoint> fp;
-        MatchNodeVec children;
-
-        MatchNode(SP<FramePoint> fpArg) : fp(fpArg) {}
-};
-
-using MatchNodeDist = pair<SP<MatchNode>, double>;
-using MatchPriorityQueue = vector<MatchNodeDist>;
-
-class MatchNodeInt {
-    public:
-        int index;
-        vector<SP<MatchNodeInt>> children;
-
-        MatchNodeInt(int indexArg) : index(indexArg) {}
-};
-
-class Frame {
+class Frame : public Slotted<Frame> {
     public:
         const int id;
         int64_t timestamp;
@@ -144,12 +167,16 @@ class Frame {
         int level = 999;
         double landmarkDistThreshold = 0;
         bool valid = false;
-        SP<Mat> descs;
-        vector<MatchNodeVec> matchTree;
+        FrameKeyPoints kps;
+        KeyPointGrid grid; //Over kps.x, kps.y
+        FramePointVec fpList; //Frame points by keypoint index, as referenced by the matchIndex nodes
+        SP<MatchIndex> matchIndex;
+        SP<MultiIndexHash> hashIndex; //Only built with matchMultiIndex
+        SP<VocabularyIndex> vocabIndex; //Only built with a loaded vocabulary
         bool isCurrFrame = false;
         bool isKeyFrame = false;
+        BowVector bow; //Only computed with bowCandidates
 
-        // SP<Mat> bowDesc;
         // bool fixed = false;
 
         // Frame(int idArg, SP<Pose> poseArg, const double degArg[3]): 
@@ -162,21 +189,21 @@ class Frame {
             for (int i = 0; i <3; i++) deg[i] = degArg[i];
         }
 };
-using FrameSet = set<SP<Frame>>;
+using FrameSet = SlotSet<Frame>;
 using FrameVec = vector<SP<Frame>>;
-using FrameRank = map<SP<Frame>, int>;
+using FrameRank = SlotMap<Frame, int>;
 
-using FramePoseMap = map<SP<Frame>, SP<Pose>>;
-using LandmarkTransMap = map<SP<Landmark>, Vector3d>;
+using FramePoseMap = SlotMap<Frame, SP<Pose>>;
+using LandmarkTransMap = SlotMap<Landmark, Vector3d>;
 
 
 using FramePointLandmarkPair = pair<SP<FramePoint>, SP<Landmark>>;
-using FramePointLandmarkPairSet = set<FramePointLandmarkPair>;
-using FrameFpLandmarks = map<SP<Frame>, SP<FramePointLandmarkPairSet>>;
-using FrameLandmarksMap = map<SP<Frame>, SP<LandmarkSet>>;
+using FramePointLandmarkPairVec = vector<FramePointLandmarkPair, ArenaAllocator<FramePointLandmarkPair>>;
+using FrameFpLandmarks = SlotMap<Frame, SP<FramePointLandmarkPairVec>>;
+using FrameLandmarksMap = SlotMap<Frame, SP<LandmarkSet>>;
 using FrameLandmarksPair = pair<SP<Frame>, SP<LandmarkSet>>;
 using FrameLandmarksPairVec = vector<FrameLandmarksPair>;
-using LandmarkFramesMap = map<SP<Landmark>, SP<FrameSet>>;
+using LandmarkFramesMap = SlotMap<Landmark, SP<FrameSet>>;
 using LandmarkFramesPair = pair<SP<Landmark>, SP<FrameSet>>;
 using LandmarkFramesPairVec = vector<LandmarkFramesPair>;
 using LandmarkDistancePair = pair<SP<Landmark>, double>;
@@ -218,52 +245,57 @@ class FpValidResult {
         double              py;
 };
 
+//Result of every frame or landmark. The sets of the frames or landmarks with a result are
+//built on request, from the results in slot order, on the arena of the results.
 template <typename T> class ValidResult {
     protected:
-        map<T, ValidateResultType> results;
-        map<ValidateResultType, SP<set<T>>> sets;
+        SlotMap<T, ValidateResultType> results;
+        int counts[4] = {0, 0, 0, 0}; //By result, from UNSET
 
     public:
-        void put(T t, ValidateResultType result) {
-            if (sets.count(result) == 0) sets[result] = make_shared<set<T>>();
-            if (results.count(t) > 0) {
-                auto prevResult = results[t];
-                sets[prevResult]->erase(t);
+        ValidResult(FrameArena* arena = nullptr) : results(arena) {}
+
+        void put(SP<T> t, ValidateResultType result) {
+            auto it = results.find(t);
+            if (it != results.end()) {
+                counts[it->second - UNSET]--;
+                it->second = result;
+            } else {
+                results[t] = result;
             }
-            results[t] = result;
-            sets[result]->insert(t);
+            counts[result - UNSET]++;
         }
 
-        ValidateResultType get(T t) {
+        ValidateResultType get(SP<T> t) {
             assert(results.count(t) > 0);
-            return results[t];
+            return results.find(t)->second;
         }
 
-        bool exists(T t) {return results.count(t) > 0;}
+        bool exists(SP<T> t) {return results.count(t) > 0;}
 
-        void replace(T orig, T repl) {
+        void replace(SP<T> orig, SP<T> repl) {
             if (results.count(orig) == 0) return;
-            auto result = results[orig];
-            sets[result]->erase(orig);
-            sets[result]->insert(repl);
-            results[repl] = result;
+            auto result = get(orig);
             results.erase(orig);
+            counts[result - UNSET]--;
+            put(repl, result);
         }
 
-        SP<set<T>> get(ValidateResultType result) {
-            if (sets.count(result) == 0) sets[result] = make_shared<set<T>>();
-            return sets[result];
+        SP<SlotSet<T>> get(ValidateResultType result) {
+            auto set = arena_shared<SlotSet<T>>(results.arena(), results.arena());
+            for (auto& [t, value] : results) {
+                if (value == result) set->insert(t);
+            }
+            return set;
         }
 
-        int size(ValidateResultType result) { 
-            return sets.count(result) > 0? sets[result]->size(): 0;
-        }
+        int size(ValidateResultType result) { return counts[result - UNSET]; }
         int size() { return (int)results.size();}
 };
 
-using FpLandmarkResult = map<SP<FramePoint>, map<SP<Landmark>, SP<FpValidResult>>>;
-using LandmarkResult = ValidResult<SP<Landmark>>;
-using FrameResult = ValidResult<SP<Frame>>;
+using FpLandmarkResult = SlotMap<FramePoint, SlotMap<Landmark, SP<FpValidResult>, false>, false>;
+using LandmarkResult = ValidResult<Landmark>;
+using FrameResult = ValidResult<Frame>;
 
 class ValidatorOutput {
     public:
@@ -315,13 +347,14 @@ class BaHelperOutput {
             SP<FrameSet> fixedFramesArg, 
             SP<FrameRank> frameRankArg,
             int maxRankArg,
-            SP<ValidatorOutput> validatorOutputArg) :
+            SP<ValidatorOutput> validatorOutputArg,
+            FrameArena* arena = nullptr) :
             //Explicitly making a copy of the elements here. Otherwise it messes with the
             // landmark replace logic. Changing in one place was changing in multiple 
             // outputs, since they were sharing the same landmarkSet.
-            landmarkSet(make_shared<LandmarkSet>()), 
+            landmarkSet(arena_shared<LandmarkSet>(arena, arena)), 
             frameSet(frameSetArg),
-            fixedLandmarks(make_shared<LandmarkSet>()), 
+            fixedLandmarks(arena_shared<LandmarkSet>(arena, arena)), 
             fixedFrames(fixedFramesArg),
             frameRank(frameRankArg),
             maxRank(maxRankArg),
@@ -359,6 +392,9 @@ enum PoseManagerStatusType {
 
 class PoseManagerOutput {
     public:
+        //Scratch data of the frame, e.g. the results, is on this arena. Declared first so
+        //it is destroyed last, the arena is only recycled once the output is released.
+        SP<FrameArena> arena;
         bool valid = false;
         PoseManagerStatusType status = DEFAULT;
         SP<Frame> frame;
@@ -369,19 +405,6 @@ class PoseManagerOutput {
         SP<LandmarkPairVec> replacements = make_shared<LandmarkPairVec>();
 };
 
-#define MAX_KPS 1500
-#define MAX_TREES 5
-struct ExportData {
-    float imgWidth = 0;
-    float imgHeight = 0;
-    float kpSize = 0;
-    float treeSize = 0;
-    float x[MAX_KPS];
-    float y[MAX_KPS];
-    float desc[MAX_KPS][8];
-    float trees[MAX_TREES][MAX_KPS*2];
-} ;
-
 #define LOG_START "LOG_START"
 #define LOG_END "LOG_END"
 
@@ -0,0 +1,147 @@
+/**
+ * @file frameArena.hpp
+ * @brief Monotonic arena for the scratch data of one frame's pose estimation, e.g. the
+ * validation results of every RANSAC hypothesis. Allocation bumps a pointer in the
+ * current chunk and freeing is a no-op, the memory is only given back all at once by
+ * reset(), which keeps the chunks for the next frame.
+ * ArenaAllocator allocates from an arena, or from the heap without one, so containers
+ * with it have one type whether or not they are built on an arena. Copies of such a
+ * container are on the heap, only the containers explicitly built on the arena use it.
+ * Nothing allocated on an arena may outlive its reset. Objects made by arena_shared keep
+ * the arena they are on alive, so an arena whose shared_ptr is unique has none left.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __FRAME_ARENA_HPP__
+#define __FRAME_ARENA_HPP__
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+#define FRAME_ARENA_CHUNK_SIZE (256*1024)
+
+class FrameArena : public enable_shared_from_this<FrameArena> {
+    protected:
+        struct Chunk {
+            unique_ptr<char[]> data;
+            size_t size;
+        };
+        vector<Chunk> _chunks;
+        size_t _chunk = 0;  //Chunk being allocated from
+        size_t _offset = 0; //Bytes used in it
+        size_t _chunkSize;
+
+    public:
+        FrameArena(size_t chunkSize = FRAME_ARENA_CHUNK_SIZE) : _chunkSize(chunkSize) {}
+
+        FrameArena(const FrameArena&) = delete;
+        FrameArena& operator=(const FrameArena&) = delete;
+
+        void* allocate(size_t bytes, size_t alignment) {
+            while (_chunk < _chunks.size()) {
+                auto& chunk = _chunks[_chunk];
+                uintptr_t base = (uintptr_t)chunk.data.get();
+                size_t start = ((base + _offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+                if (start + bytes <= chunk.size) {
+                    _offset = start + bytes;
+                    return chunk.data.get() + start;
+                }
+                _chunk++;
+                _offset = 0;
+            }
+            //Chunks double up to be at least as large as the request
+            size_t size = _chunks.empty()? _chunkSize : _chunks.back().size*2;
+            while (size < bytes + alignment) size *= 2;
+            _chunks.push_back({unique_ptr<char[]>(new char[size]), size});
+            _chunk = _chunks.size() - 1;
+            _offset = 0;
+            return allocate(bytes, alignment);
+        }
+
+        //Everything allocated is released at once, the chunks are kept
+        void reset() {
+            _chunk = 0;
+            _offset = 0;
+        }
+
+        size_t capacity() const {
+            size_t total = 0;
+            for (auto& chunk : _chunks) total += chunk.size;
+            return total;
+        }
+};
+
+template <typename T> class ArenaAllocator {
+    public:
+        using value_type = T;
+        FrameArena* arena;
+
+        ArenaAllocator(FrameArena* arenaArg = nullptr) noexcept : arena(arenaArg) {}
+
+        template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {}
+
+        T* allocate(size_t n) {
+            if (!arena) return static_cast<T*>(::operator new(n*sizeof(T)));
+            return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* p, size_t) noexcept {
+            if (!arena) ::operator delete(p);
+        }
+
+        //A container keeps the allocator it was built with: copies go on the heap, and
+        //assignment and swap never move a container onto another arena. Swapping containers
+        //on different arenas is not allowed.
+        using propagate_on_container_copy_assignment = false_type;
+        using propagate_on_container_move_assignment = false_type;
+        using propagate_on_container_swap = false_type;
+        using is_always_equal = false_type;
+
+        ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+        template <typename U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+        template <typename U> bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+//Types taking the arena to build on in their constructor, see SlotMap
+template <typename T, typename = void> struct uses_frame_arena : false_type {};
+template <typename T> struct uses_frame_arena<T, void_t<typename T::frame_arena_aware>> : true_type {};
+
+//Allocator of arena_shared, holding the arena so it is not reset while the object is alive
+template <typename T> class ArenaOwnerAllocator {
+    public:
+        using value_type = T;
+        shared_ptr<FrameArena> arena;
+
+        ArenaOwnerAllocator(shared_ptr<FrameArena> arenaArg) noexcept : arena(std::move(arenaArg)) {}
+
+        template <typename U> ArenaOwnerAllocator(const ArenaOwnerAllocator<U>& other) noexcept : arena(other.arena) {}
+
+        T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T))); }
+
+        void deallocate(T*, size_t) noexcept {}
+
+        template <typename U> bool operator==(const ArenaOwnerAllocator<U>& other) const { return arena == other.arena; }
+        template <typename U> bool operator!=(const ArenaOwnerAllocator<U>& other) const { return arena != other.arena; }
+};
+
+//make_shared on the arena, or on the heap without one. An arena not owned by a shared_ptr
+//is not kept alive by the object.
+template <typename T, typename... Args> shared_ptr<T> arena_shared(FrameArena* arena, Args&&... args) {
+    if (!arena) return make_shared<T>(forward<Args>(args)...);
+    if (auto owner = arena->weak_from_this().lock()) {
+        return allocate_shared<T>(ArenaOwnerAllocator<T>(std::move(owner)), forward<Args>(args)...);
+    }
+    return allocate_shared<T>(ArenaAllocator<T>(arena), forward<Args>(args)...);
+}
+
+#endif /* __FRAME_ARENA_HPP__ */
@@ -0,0 +1,150 @@
+/**
+ * @file hamming.hpp
+ * @brief Hamming distance kernels for the 256 bit ORB descriptors. A frame keeps its
+ * descriptors as one contiguous CV_8UC1 N x 32 matrix, so a descriptor is a 32 byte
+ * row and many descriptors can be compared against one query in a single pass.
+ * Uses AVX-512 VPOPCNTDQ, AVX2 (vpshufb nibble lookup), NEON (vcnt) or WASM SIMD128
+ * popcount when the build enables them, and 64 bit popcounts otherwise.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __HAMMING_HPP__
+#define __HAMMING_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <opencv2/core/core.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#define DESC_BYTES 32
+
+class HammingDistance {
+    public:
+        /**
+         * @brief Hamming distance of two 32 byte descriptors
+         *
+         * @param a
+         * @param b
+         * @return int
+         */
+        static inline int distance(const uchar* a, const uchar* b) {
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)a), _mm256_loadu_si256((const __m256i*)b));
+            return reduce_epi64(_mm256_popcnt_epi64(x));
+#elif defined(__AVX2__)
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)a), _mm256_loadu_si256((const __m256i*)b));
+            return reduce_epi64(popcount_epi64(x));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+            uint8x16_t c0 = vcntq_u8(veorq_u8(vld1q_u8(a), vld1q_u8(b)));
+            uint8x16_t c1 = vcntq_u8(veorq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16)));
+            return vaddlvq_u8(vaddq_u8(c0, c1));
+#elif defined(__wasm_simd128__)
+            v128_t c0 = wasm_i8x16_popcnt(wasm_v128_xor(wasm_v128_load(a), wasm_v128_load(b)));
+            v128_t c1 = wasm_i8x16_popcnt(wasm_v128_xor(wasm_v128_load(a + 16), wasm_v128_load(b + 16)));
+            v128_t sum = wasm_u32x4_extadd_pairwise_u16x8(wasm_u16x8_extadd_pairwise_u8x16(wasm_i8x16_add(c0, c1)));
+            return wasm_i32x4_extract_lane(sum, 0) + wasm_i32x4_extract_lane(sum, 1) +
+                   wasm_i32x4_extract_lane(sum, 2) + wasm_i32x4_extract_lane(sum, 3);
+#else
+            uint64_t x[4], y[4];
+            memcpy(x, a, DESC_BYTES);
+            memcpy(y, b, DESC_BYTES);
+            return __builtin_popcountll(x[0] ^ y[0]) + __builtin_popcountll(x[1] ^ y[1]) +
+                   __builtin_popcountll(x[2] ^ y[2]) + __builtin_popcountll(x[3] ^ y[3]);
+#endif
+        }
+
+        /**
+         * @brief Hamming distance of two 1 x 32 CV_8UC1 descriptors, like rows of a
+         * frame's descriptor matrix
+         *
+         * @param a
+         * @param b
+         * @return int
+         */
+        static inline int distance(const cv::Mat& a, const cv::Mat& b) {
+            CV_DbgAssert(a.type() == CV_8UC1 && a.total() == DESC_BYTES && a.isContinuous());
+            CV_DbgAssert(b.type() == CV_8UC1 && b.total() == DESC_BYTES && b.isContinuous());
+            return distance(a.ptr(), b.ptr());
+        }
+
+        /**
+         * @brief One to many: distances of query to the n contiguous descriptors of descs
+         *
+         * @param query
+         * @param descs n x 32 bytes
+         * @param n
+         * @param out n distances
+         */
+        static void distances(const uchar* query, const uchar* descs, int n, int* out) {
+#if defined(__AVX2__)
+            const __m256i q = _mm256_loadu_si256((const __m256i*)query);
+            for (int i = 0; i < n; i++) {
+                __m256i x = _mm256_xor_si256(q, _mm256_loadu_si256((const __m256i*)(descs + i*DESC_BYTES)));
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+                out[i] = reduce_epi64(_mm256_popcnt_epi64(x));
+#else
+                out[i] = reduce_epi64(popcount_epi64(x));
+#endif
+            }
+#else
+            for (int i = 0; i < n; i++) out[i] = distance(query, descs + i*DESC_BYTES);
+#endif
+        }
+
+        /**
+         * @brief One to many over the rows of a descriptor matrix
+         *
+         * @param query 1 x 32 descriptor
+         * @param descs N x 32 CV_8UC1 continuous matrix
+         * @param out N distances
+         */
+        static void distances(const cv::Mat& query, const cv::Mat& descs, int* out) {
+            CV_DbgAssert(descs.type() == CV_8UC1 && descs.cols == DESC_BYTES && descs.isContinuous());
+            distances(query.ptr(), descs.ptr(), descs.rows, out);
+        }
+
+        /**
+         * @brief Many to many: the nQueries x n distance matrix, row major
+         *
+         * @param queries nQueries x 32 bytes
+         * @param nQueries
+         * @param descs n x 32 bytes
+         * @param n
+         * @param out nQueries x n distances
+         */
+        static void distances(const uchar* queries, int nQueries, const uchar* descs, int n, int* out) {
+            for (int i = 0; i < nQueries; i++) distances(queries + i*DESC_BYTES, descs, n, out + i*n);
+        }
+
+    protected:
+#if defined(__AVX2__)
+        static inline int reduce_epi64(__m256i v) {
+            __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            return (int)(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+        }
+
+        //Bit count of every 64 bit lane, with a 4 bit lookup table per nibble
+        static inline __m256i popcount_epi64(__m256i x) {
+            const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i low = _mm256_set1_epi8(0x0f);
+            __m256i counts = _mm256_add_epi8(
+                _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+                _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+            return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        }
+#endif
+};
+
+#endif /* __HAMMING_HPP__ */
@@ -0,0 +1,103 @@
+/**
+ * @file keyPointGrid.hpp
+ * @brief Uniform grid over the keypoints of a frame, to find the keypoints near a
+ * position without scanning all of them. The keypoint indices are bucketed by cell
+ * into one array, with the start of every cell kept in another.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __KEY_POINT_GRID_HPP__
+#define __KEY_POINT_GRID_HPP__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+class KeyPointGrid {
+    public:
+        /**
+         * @brief Bucket the n points (x[i], y[i]) into cells of cellSize
+         *
+         * @param x
+         * @param y
+         * @param n
+         * @param cellSize
+         */
+        void build(const float* x, const float* y, int n, float cellSize) {
+            _cellSize = cellSize;
+            _cols = _rows = 0;
+            _indices.resize(n);
+            if (n == 0) {
+                _cellStarts.assign(1, 0);
+                return;
+            }
+            _minX = *min_element(x, x + n);
+            _minY = *min_element(y, y + n);
+            _cols = (int)((*max_element(x, x + n) - _minX)/cellSize) + 1;
+            _rows = (int)((*max_element(y, y + n) - _minY)/cellSize) + 1;
+
+            //Counting sort of the keypoints by cell
+            _cellStarts.assign(_cols*_rows + 1, 0);
+            vector<int> cells(n);
+            for (int i = 0; i < n; i++) {
+                cells[i] = cell(x[i], y[i]);
+                _cellStarts[cells[i] + 1]++;
+            }
+            for (int c = 0; c < _cols*_rows; c++) _cellStarts[c + 1] += _cellStarts[c];
+            vector<int> cursor(_cellStarts.begin(), _cellStarts.end() - 1);
+            for (int i = 0; i < n; i++) _indices[cursor[cells[i]]++] = i;
+        }
+
+        /**
+         * @brief Calls fn(index) for the keypoints in the cells overlapping the box
+         * [minX, maxX] x [minY, maxY]. The bounds may be infinite. Callers check the exact
+         * position.
+         *
+         * @param minX
+         * @param minY
+         * @param maxX
+         * @param maxY
+         * @param fn
+         */
+        template<typename F> void query(float minX, float minY, float maxX, float maxY, F fn) const {
+            if (_cols == 0) return;
+            const int col0 = max(0, cell_index(minX - _minX, _cols));
+            const int col1 = min(_cols - 1, cell_index(maxX - _minX, _cols));
+            const int row0 = max(0, cell_index(minY - _minY, _rows));
+            const int row1 = min(_rows - 1, cell_index(maxY - _minY, _rows));
+            if (col0 > col1 || row0 > row1) return;
+            for (int row = row0; row <= row1; row++) {
+                //The cells of a row are contiguous
+                const int begin = _cellStarts[row*_cols + col0];
+                const int end = _cellStarts[row*_cols + col1 + 1];
+                for (int i = begin; i < end; i++) fn(_indices[i]);
+            }
+        }
+
+    protected:
+        float _cellSize = 1;
+        float _minX = 0;
+        float _minY = 0;
+        int _cols = 0;
+        int _rows = 0;
+        vector<int> _cellStarts{0};
+        vector<int> _indices;
+
+        //Cell of offset along an axis of size cells, clamped to [-1, size] before the
+        //conversion so infinite offsets are safe
+        int cell_index(float offset, int size) const {
+            return (int)min(max(floor(offset/_cellSize), -1.0f), (float)size);
+        }
+
+        int cell(float x, float y) const {
+            return (int)((y - _minY)/_cellSize)*_cols + (int)((x - _minX)/_cellSize);
+        }
+};
+
+#endif /* __KEY_POINT_GRID_HPP__ */
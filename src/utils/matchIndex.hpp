@@ -0,0 +1,153 @@
+/**
+ * @file matchIndex.hpp
+ * @brief Hierarchical clustering index over the descriptors of a frame, used to
+ * find matches without comparing against every keypoint. Every tree picks random
+ * medoids among the keypoints, assigns the other keypoints to the nearest medoid
+ * and repeats on every medoid's keypoints until fewer than leafSize are left.
+ * The trees are kept in flat arrays: nodes are stored breadth first and the
+ * children of a node are a contiguous range of nodes.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __MATCH_INDEX_HPP__
+#define __MATCH_INDEX_HPP__
+
+#include <vector>
+#include <numeric>
+#include <random>
+#include <opencv2/core/core.hpp>
+#include "hamming.hpp"
+
+using namespace std;
+
+struct MatchIndexNode {
+    int index;      //Keypoint index, the row of the descriptor matrix. -1 for the root of a tree
+    int childBegin; //Children are the nodes [childBegin, childEnd), empty for a leaf
+    int childEnd;
+};
+
+class MatchIndex {
+    public:
+        //Nodes of every tree, one tree after the other
+        vector<MatchIndexNode> nodes;
+        //Root node of every tree. The root has no keypoint, its children are the top medoids.
+        vector<int> treeRoots;
+
+        int tree_count() const { return (int)treeRoots.size(); }
+
+        /**
+         * @brief Replace the index with the trees serialized by another index, e.g. the
+         * nodes carried by ExportData from the extraction stage. No node is rebuilt, the
+         * arrays are copied as they are.
+         *
+         * @param roots
+         * @param nTrees
+         * @param nodesArg
+         * @param nNodes
+         */
+        void assign(const int* roots, int nTrees, const MatchIndexNode* nodesArg, int nNodes) {
+            treeRoots.assign(roots, roots + nTrees);
+            nodes.assign(nodesArg, nodesArg + nNodes);
+        }
+
+        /**
+         * @brief Build treeSize trees over the rows of descs. Scratch buffers are kept
+         * across calls, so building the index of a frame does not allocate per node.
+         * The medoids are drawn with the index's own engine, seeded by seed, so the trees
+         * of a frame do not depend on what else draws random numbers meanwhile.
+         *
+         * @param descs N x DESC_BYTES CV_8UC1 continuous descriptor matrix
+         * @param treeSize
+         * @param branchSize Medoids picked for a node with leafSize keypoints or more
+         * @param leafSize
+         * @param seed
+         */
+        void build(const cv::Mat& descs, int treeSize, int branchSize, int leafSize, unsigned seed) {
+            const int n = descs.rows;
+            _rng.seed(seed);
+            nodes.clear();
+            nodes.reserve((size_t)treeSize*(n + 1));
+            treeRoots.clear();
+            _segBegin.clear();
+            _segEnd.clear();
+            _perm.resize(n);
+            _assign.resize(n);
+            _sorted.resize(n);
+            _pivotDescs.resize((size_t)branchSize*DESC_BYTES);
+            _pivotDistances.resize(branchSize);
+            _counts.resize(branchSize + 1);
+
+            for (int tree = 0; tree < treeSize; tree++) {
+                iota(_perm.begin(), _perm.end(), 0);
+                treeRoots.push_back((int)nodes.size());
+                add_node(-1, 0, n);
+                //Breadth first, the children of node i are appended after all the nodes before them
+                for (int i = treeRoots[tree]; i < (int)nodes.size(); i++) {
+                    nodes[i].childBegin = (int)nodes.size();
+                    if (_segEnd[i] > _segBegin[i]) split(descs, _segBegin[i], _segEnd[i], branchSize, leafSize);
+                    nodes[i].childEnd = (int)nodes.size();
+                }
+            }
+        }
+
+    protected:
+        //Keypoint permutation of the tree being built. The keypoints left to place under
+        //node i are [_segBegin[i], _segEnd[i]) of it.
+        vector<int> _perm;
+        vector<int> _segBegin;
+        vector<int> _segEnd;
+        vector<int> _assign;
+        vector<int> _sorted;
+        vector<int> _counts;
+        vector<uchar> _pivotDescs;
+        vector<int> _pivotDistances;
+        mt19937 _rng;
+
+        void add_node(int index, int segBegin, int segEnd) {
+            nodes.push_back({index, 0, 0});
+            _segBegin.push_back(segBegin);
+            _segEnd.push_back(segEnd);
+        }
+
+        //Adds the medoids of the keypoints [begin, end) of _perm as nodes, and groups the
+        //other keypoints of the range by their nearest medoid
+        void split(const cv::Mat& descs, int begin, int end, int branchSize, int leafSize) {
+            const int count = end - begin;
+            const int nPivots = count < leafSize? count : min(branchSize, count);
+            for (int k = 0; k < nPivots; k++) {
+                int pick = begin + k + _rng() % (count - k);
+                swap(_perm[begin + k], _perm[pick]);
+            }
+            const int firstPivot = (int)nodes.size();
+            for (int k = 0; k < nPivots; k++) add_node(_perm[begin + k], 0, 0);
+            if (nPivots == count) return;
+
+            for (int k = 0; k < nPivots; k++)
+                memcpy(&_pivotDescs[k*DESC_BYTES], descs.ptr(_perm[begin + k]), DESC_BYTES);
+            fill(_counts.begin(), _counts.begin() + nPivots + 1, 0);
+            for (int i = begin + nPivots; i < end; i++) {
+                HammingDistance::distances(descs.ptr(_perm[i]), _pivotDescs.data(), nPivots, _pivotDistances.data());
+                int nearest = 0;
+                for (int k = 1; k < nPivots; k++)
+                    if (_pivotDistances[k] < _pivotDistances[nearest]) nearest = k;
+                _assign[i] = nearest;
+                _counts[nearest + 1]++;
+            }
+
+            //Counting sort of the range by medoid
+            const int rest = begin + nPivots;
+            for (int k = 0; k < nPivots; k++) _counts[k + 1] += _counts[k];
+            for (int k = 0; k < nPivots; k++) {
+                _segBegin[firstPivot + k] = rest + _counts[k];
+                _segEnd[firstPivot + k] = rest + _counts[k + 1];
+            }
+            for (int i = rest; i < end; i++) _sorted[rest + _counts[_assign[i]]++] = _perm[i];
+            copy(_sorted.begin() + rest, _sorted.begin() + end, _perm.begin() + rest);
+        }
+};
+
+#endif /* __MATCH_INDEX_HPP__ */
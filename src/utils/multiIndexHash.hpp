@@ -0,0 +1,121 @@
+/**
+ * @file multiIndexHash.hpp
+ * @brief Multi-index hashing over the descriptors of a frame, for exact Hamming
+ * neighbour search. Every 256 bit descriptor is split into MIH_SUBSTRINGS substrings
+ * of one byte, and every substring has its own table of keypoints bucketed by the byte,
+ * so a probe is a direct lookup of the bucket. One byte per substring suits frames of
+ * about a thousand keypoints: the buckets hold a few keypoints each, and radius 63 is
+ * reached after probing 1 + 8 keys per substring.
+ * Two descriptors within distance d share at least one substring within
+ * d/MIH_SUBSTRINGS bits, so probing every table with the keys within s bits of the
+ * query's substrings finds every keypoint within MIH_SUBSTRINGS*(s + 1) - 1.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __MULTI_INDEX_HASH_HPP__
+#define __MULTI_INDEX_HASH_HPP__
+
+#include <vector>
+#include <cstdint>
+#include <opencv2/core/core.hpp>
+#include "hamming.hpp"
+
+using namespace std;
+
+#define MIH_SUBSTRINGS DESC_BYTES
+#define MIH_BUCKETS 256
+//Every key of a substring is probed by this stage, so every keypoint has been visited
+#define MIH_MAX_STAGE 8
+
+class MultiIndexHash {
+    public:
+        /**
+         * @brief Index the rows of descs
+         *
+         * @param descs N x DESC_BYTES CV_8UC1 continuous descriptor matrix
+         */
+        void build(const cv::Mat& descs) {
+            _descs = descs;
+            const int n = descs.rows;
+            //Counting sort of the keypoints by the byte of every substring
+            _bucketStarts.assign(MIH_SUBSTRINGS*(MIH_BUCKETS + 1), 0);
+            _indices.resize((size_t)MIH_SUBSTRINGS*n);
+            for (int i = 0; i < n; i++) {
+                const uchar* desc = descs.ptr(i);
+                for (int t = 0; t < MIH_SUBSTRINGS; t++) _bucketStarts[t*(MIH_BUCKETS + 1) + desc[t] + 1]++;
+            }
+            for (int t = 0; t < MIH_SUBSTRINGS; t++) {
+                int* starts = &_bucketStarts[t*(MIH_BUCKETS + 1)];
+                for (int b = 0; b < MIH_BUCKETS; b++) starts[b + 1] += starts[b];
+            }
+            vector<int> cursor(_bucketStarts);
+            for (int i = 0; i < n; i++) {
+                const uchar* desc = descs.ptr(i);
+                for (int t = 0; t < MIH_SUBSTRINGS; t++) {
+                    _indices[(size_t)t*n + cursor[t*(MIH_BUCKETS + 1) + desc[t]]++] = i;
+                }
+            }
+        }
+
+        /**
+         * @brief Visit the keypoints near query in stages of growing radius. Stage s visits
+         * every keypoint within radius MIH_SUBSTRINGS*(s + 1) - 1 not visited before, calling
+         * visit(index, distance) once per keypoint. After every stage done(radius) decides
+         * whether to go on, so the depth of the search follows what the caller still needs
+         * to know, e.g. up to its distance threshold. Every keypoint has been visited once
+         * the radius reaches 256.
+         *
+         * @param query DESC_BYTES descriptor
+         * @param visit
+         * @param done
+         */
+        template<typename V, typename D> void search(const uchar* query, V visit, D done) const {
+            const int n = _descs.rows;
+            if (n == 0) return;
+            //Kept per thread, the frames of several match frames are searched concurrently
+            thread_local vector<uint64_t> seen;
+            seen.assign((n + 63)/64, 0);
+            const auto& masks = probe_masks();
+            for (int s = 0; s <= MIH_MAX_STAGE; s++) {
+                for (int t = 0; t < MIH_SUBSTRINGS; t++) {
+                    const int* starts = &_bucketStarts[t*(MIH_BUCKETS + 1)];
+                    const int* indices = &_indices[(size_t)t*n];
+                    for (auto mask : masks[s]) {
+                        const int key = query[t] ^ mask;
+                        for (int i = starts[key]; i < starts[key + 1]; i++) {
+                            const int index = indices[i];
+                            if (seen[index >> 6] & (1ull << (index & 63))) continue;
+                            seen[index >> 6] |= 1ull << (index & 63);
+                            visit(index, HammingDistance::distance(query, _descs.ptr(index)));
+                        }
+                    }
+                }
+                if (done(MIH_SUBSTRINGS*(s + 1) - 1)) return;
+            }
+        }
+
+    protected:
+        cv::Mat _descs;
+        //Start of every bucket in _indices, by substring
+        vector<int> _bucketStarts;
+        //Keypoints by bucket, N per substring
+        vector<int> _indices;
+
+        //Byte masks by the number of bits they flip
+        static const vector<vector<uint8_t>>& probe_masks() {
+            static const vector<vector<uint8_t>> masks = [] {
+                vector<vector<uint8_t>> result(MIH_MAX_STAGE + 1);
+                for (int mask = 0; mask < MIH_BUCKETS; mask++) {
+                    result[__builtin_popcount(mask)].push_back((uint8_t)mask);
+                }
+                return result;
+            }();
+            return masks;
+        }
+};
+
+#endif /* __MULTI_INDEX_HASH_HPP__ */
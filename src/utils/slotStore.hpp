@@ -0,0 +1,265 @@
+/**
+ * @file slotStore.hpp
+ * @brief Sets and maps of frames, landmarks and framepoints keyed by slot instead of by
+ * pointer. Every entity takes the lowest free slot of its type from a SlotRegistry, and
+ * gives it back when it is destroyed, so the slots stay dense. A store holds a shared_ptr
+ * to every key, so no slot in a store is given to another entity while it is there.
+ * The stores keep their entries in a vector sorted by slot. With Bits a bitset over the
+ * slots answers count() with one bit test; without it count() is a binary search, for
+ * the small stores (e.g. the points of a landmark) where a bitset over every slot would
+ * cost more than the entries. Iteration follows the slots, not the heap addresses, so it
+ * is the same on every run that creates the entities in the same order.
+ * A store built on a FrameArena allocates its entries from it, copies are on the heap.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __SLOT_STORE_HPP__
+#define __SLOT_STORE_HPP__
+
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <cstdint>
+#include <assert.h>
+
+#include "frameArena.hpp"
+
+using namespace std;
+
+//Slots of one entity type. Entities are created and destroyed on the extraction, pose and
+//matching threads, so the registry is locked.
+template <typename T> class SlotRegistry {
+    protected:
+        mutex _mutex;
+        int _size = 0;
+        priority_queue<int, vector<int>, greater<int>> _free;
+
+    public:
+        //Never destroyed, entities owned by other statics may release their slots at exit
+        static SlotRegistry& instance() {
+            static SlotRegistry* registry = new SlotRegistry();
+            return *registry;
+        }
+
+        int acquire() {
+            lock_guard<mutex> lock(_mutex);
+            if (_free.empty()) return _size++;
+            int slot = _free.top();
+            _free.pop();
+            return slot;
+        }
+
+        void release(int slot) {
+            lock_guard<mutex> lock(_mutex);
+            assert(slot >= 0 && slot < _size);
+            _free.push(slot);
+        }
+};
+
+//Base of the entities kept in slot stores. A copy takes a slot of its own.
+template <typename T> class Slotted {
+    protected:
+        int _slot = -1;
+
+    public:
+        Slotted(bool bind = true) { if (bind) bind_slot(); }
+        Slotted(const Slotted&) : Slotted(true) {}
+        Slotted& operator=(const Slotted&) { return *this; }
+        ~Slotted() { if (_slot >= 0) SlotRegistry<T>::instance().release(_slot); }
+
+        void bind_slot() { if (_slot < 0) _slot = SlotRegistry<T>::instance().acquire(); }
+        int slot() const { return _slot; }
+};
+
+//Sorted vector of entries keyed by the slot of a shared_ptr<K>, see SlotSet and SlotMap
+template <typename K, typename E, bool Bits> class SlotStore {
+    protected:
+        using Entries = vector<E, ArenaAllocator<E>>;
+        Entries _entries;
+        vector<uint64_t, ArenaAllocator<uint64_t>> _bits;
+
+        static const shared_ptr<K>& key_of(const shared_ptr<K>& entry) { return entry; }
+        template <typename V> static const shared_ptr<K>& key_of(const pair<shared_ptr<K>, V>& entry) { return entry.first; }
+        static int slot_of(const E& entry) { return key_of(entry)->slot(); }
+
+        void set_bit(int slot, bool value) {
+            if (!Bits) return;
+            size_t word = slot >> 6;
+            if (word >= _bits.size()) {
+                if (!value) return;
+                _bits.resize(word + 1, 0);
+            }
+            if (value) _bits[word] |= 1ull << (slot & 63);
+            else _bits[word] &= ~(1ull << (slot & 63));
+        }
+
+        typename Entries::iterator lower(int slot) {
+            return lower_bound(_entries.begin(), _entries.end(), slot,
+                [](const E& entry, int s) { return slot_of(entry) < s; });
+        }
+
+        typename Entries::const_iterator lower(int slot) const {
+            return lower_bound(_entries.begin(), _entries.end(), slot,
+                [](const E& entry, int s) { return slot_of(entry) < s; });
+        }
+
+        //Position of key, or where it goes. The common case of a key after all the others is
+        //appended without a search.
+        pair<typename Entries::iterator, bool> locate(const shared_ptr<K>& key) {
+            int slot = key->slot();
+            assert(slot >= 0);
+            if (_entries.empty() || slot_of(_entries.back()) < slot) return make_pair(_entries.end(), false);
+            if (Bits && !test(slot)) return make_pair(lower(slot), false);
+            auto it = lower(slot);
+            return make_pair(it, it != _entries.end() && slot_of(*it) == slot);
+        }
+
+        typename Entries::iterator insert_at(typename Entries::iterator it, E entry) {
+            set_bit(slot_of(entry), true);
+            return _entries.insert(it, std::move(entry));
+        }
+
+    public:
+        using value_type = E;
+        using iterator = typename Entries::iterator;
+        using const_iterator = typename Entries::const_iterator;
+        using frame_arena_aware = true_type;
+
+        SlotStore(FrameArena* arena = nullptr) : _entries(ArenaAllocator<E>(arena)), _bits(ArenaAllocator<uint64_t>(arena)) {}
+
+        FrameArena* arena() const { return _entries.get_allocator().arena; }
+
+        bool test(int slot) const {
+            if (!Bits) {
+                auto it = lower(slot);
+                return it != _entries.end() && slot_of(*it) == slot;
+            }
+            size_t word = slot >> 6;
+            return word < _bits.size() && (_bits[word] >> (slot & 63)) & 1;
+        }
+
+        size_t count(const shared_ptr<K>& key) const {
+            //Entities without a slot are never in a store
+            return key->slot() >= 0 && test(key->slot())? 1 : 0;
+        }
+
+        size_t size() const { return _entries.size(); }
+        bool empty() const { return _entries.empty(); }
+
+        void clear() {
+            for (auto& entry : _entries) set_bit(slot_of(entry), false);
+            _entries.clear();
+        }
+
+        size_t erase(const shared_ptr<K>& key) {
+            if (count(key) == 0) return 0;
+            set_bit(key->slot(), false);
+            _entries.erase(lower(key->slot()));
+            return 1;
+        }
+
+        //Erases the entry at it and returns the one after it, to erase while iterating
+        iterator erase(const_iterator it) {
+            set_bit(slot_of(*it), false);
+            return _entries.erase(it);
+        }
+
+        iterator find(const shared_ptr<K>& key) {
+            return count(key) == 0? _entries.end() : lower(key->slot());
+        }
+
+        const_iterator find(const shared_ptr<K>& key) const {
+            return count(key) == 0? _entries.end() : lower(key->slot());
+        }
+
+        iterator begin() { return _entries.begin(); }
+        iterator end() { return _entries.end(); }
+        const_iterator begin() const { return _entries.begin(); }
+        const_iterator end() const { return _entries.end(); }
+};
+
+/**
+ * @brief Set of shared_ptr<K> ordered by slot. Unlike std::set, inserting or erasing moves
+ * the members after the position, so iterators do not outlive a change of the set.
+ */
+template <typename K, bool Bits = true> class SlotSet : public SlotStore<K, shared_ptr<K>, Bits> {
+    protected:
+        using Base = SlotStore<K, shared_ptr<K>, Bits>;
+
+    public:
+        SlotSet(FrameArena* arena = nullptr) : Base(arena) {}
+
+        template <typename It> SlotSet(It first, It last) { insert(first, last); }
+
+        pair<typename Base::iterator, bool> insert(const shared_ptr<K>& key) {
+            auto [it, found] = Base::locate(key);
+            if (found) return make_pair(it, false);
+            return make_pair(Base::insert_at(it, key), true);
+        }
+
+        //Appends the new members and merges them in, instead of inserting them one by one
+        template <typename It> void insert(It first, It last) {
+            auto& entries = Base::_entries;
+            size_t sorted = entries.size();
+            for (; first != last; ++first) {
+                const shared_ptr<K>& key = *first;
+                assert(key->slot() >= 0);
+                if (Bits && Base::test(key->slot())) continue;
+                Base::set_bit(key->slot(), true);
+                entries.push_back(key);
+            }
+            if (sorted == entries.size()) return;
+            auto bySlot = [](const shared_ptr<K>& a, const shared_ptr<K>& b) { return a->slot() < b->slot(); };
+            sort(entries.begin() + sorted, entries.end(), bySlot);
+            inplace_merge(entries.begin(), entries.begin() + sorted, entries.end(), bySlot);
+            if (!Bits) {
+                entries.erase(unique(entries.begin(), entries.end(),
+                    [](const shared_ptr<K>& a, const shared_ptr<K>& b) { return a->slot() == b->slot(); }), entries.end());
+            }
+        }
+};
+
+/**
+ * @brief Map from shared_ptr<K> to V ordered by slot, with the values stored next to
+ * their keys. Like SlotSet, references to the values do not outlive an insert or erase.
+ */
+template <typename K, typename V, bool Bits = true> class SlotMap : public SlotStore<K, pair<shared_ptr<K>, V>, Bits> {
+    protected:
+        using Base = SlotStore<K, pair<shared_ptr<K>, V>, Bits>;
+
+    public:
+        SlotMap(FrameArena* arena = nullptr) : Base(arena) {}
+
+        V& operator[](const shared_ptr<K>& key) {
+            auto [it, found] = Base::locate(key);
+            if (found) return it->second;
+            //Built in place at the end and rotated into position, the value is not copied
+            //before the caller sets it. Values that are stores themselves go on the same arena.
+            auto& entries = Base::_entries;
+            size_t position = it - entries.begin();
+            Base::set_bit(key->slot(), true);
+            if constexpr (uses_frame_arena<V>::value) {
+                entries.emplace_back(piecewise_construct, forward_as_tuple(key), forward_as_tuple(Base::arena()));
+            } else {
+                entries.emplace_back(piecewise_construct, forward_as_tuple(key), forward_as_tuple());
+            }
+            rotate(entries.begin() + position, entries.end() - 1, entries.end());
+            return entries[position].second;
+        }
+
+        V& at(const shared_ptr<K>& key) {
+            auto it = Base::find(key);
+            assert(it != Base::end());
+            return it->second;
+        }
+};
+
+#endif /* __SLOT_STORE_HPP__ */
@@ -0,0 +1,262 @@
+/**
+ * @file threadPool.hpp
+ * @brief Fixed size pool of worker threads used to run independent tasks,
+ * like per level / per cell row ORB extraction, in parallel, and single worker
+ * executors used as pipeline stages.
+ * A pool with 0 workers runs every task inline on the calling thread. The WASM
+ * build is single threaded and hence always runs tasks inline.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <vector>
+#include <queue>
+#include <functional>
+#include <future>
+#include <memory>
+#if !WASM_COMPILE
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+using namespace std;
+
+class ThreadPool {
+    protected:
+#if !WASM_COMPILE
+        vector<thread> _workers;
+        queue<function<void()>> _tasks;
+        mutex _mutex;
+        condition_variable _cv;
+        bool _stop = false;
+
+        void run_worker() {
+            while (true) {
+                function<void()> task;
+                {
+                    unique_lock<mutex> lock(_mutex);
+                    _cv.wait(lock, [this] { return _stop || !_tasks.empty(); });
+                    if (_stop && _tasks.empty()) return;
+                    task = std::move(_tasks.front());
+                    _tasks.pop();
+                }
+                task();
+            }
+        }
+
+        //Progress of one parallel_for, shared with the helper tasks it queued
+        struct RangeState {
+            atomic<int> next;
+            int remaining;
+            mutex guard;
+            condition_variable finished;
+            exception_ptr error;
+        };
+#endif
+
+    public:
+        /**
+         * @brief Construct a new Thread Pool
+         *
+         * @param numThreads Number of worker threads. 0 or 1 runs tasks inline.
+         */
+        ThreadPool(int numThreads) {
+#if !WASM_COMPILE
+            if (numThreads <= 1) return;
+            for (int i = 0; i < numThreads; i++)
+                _workers.emplace_back([this] { run_worker(); });
+#endif
+        }
+
+        ~ThreadPool() {
+#if !WASM_COMPILE
+            {
+                lock_guard<mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cv.notify_all();
+            for (auto& worker : _workers) worker.join();
+#endif
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        int size() {
+#if !WASM_COMPILE
+            return (int)_workers.size();
+#else
+            return 0;
+#endif
+        }
+
+        /**
+         * @brief Queue a task for execution. The returned future holds the
+         * result or the exception thrown by the task.
+         *
+         * @param fn
+         * @return future<R>
+         */
+        template<typename F, typename R = invoke_result_t<F>>
+        future<R> submit(F&& fn) {
+            auto task = make_shared<packaged_task<R()>>(std::forward<F>(fn));
+            auto result = task->get_future();
+#if !WASM_COMPILE
+            if (!_workers.empty()) {
+                {
+                    lock_guard<mutex> lock(_mutex);
+                    _tasks.emplace([task] { (*task)(); });
+                }
+                _cv.notify_one();
+                return result;
+            }
+#endif
+            (*task)();
+            return result;
+        }
+
+        /**
+         * @brief Run fn(index) for every index in [begin, end) and wait for all of
+         * them to finish. The calling thread works on the range too, so this is
+         * safe to call from within a pool task. Indices are handed out in order,
+         * the first exception thrown by fn is rethrown once all work is done.
+         * The calling thread only runs indices of this range, never other queued
+         * tasks, and only waits for the indices already taken by workers. A helper
+         * that starts after the range is done returns without calling fn.
+         *
+         * @param begin
+         * @param end
+         * @param fn
+         */
+        template<typename F>
+        void parallel_for(int begin, int end, F&& fn) {
+            if (begin >= end) return;
+            if (size() == 0 || end - begin == 1) {
+                for (int index = begin; index < end; index++) fn(index);
+                return;
+            }
+#if !WASM_COMPILE
+            auto state = make_shared<RangeState>();
+            state->next = begin;
+            state->remaining = end - begin;
+            auto work = [state, end, &fn] {
+                for (int index = state->next++; index < end; index = state->next++) {
+                    exception_ptr error;
+                    try {
+                        fn(index);
+                    } catch (...) {
+                        error = current_exception();
+                    }
+                    lock_guard<mutex> lock(state->guard);
+                    if (error && !state->error) state->error = error;
+                    if (--state->remaining == 0) state->finished.notify_all();
+                }
+            };
+            int numHelpers = min(size(), end - begin - 1);
+            {
+                lock_guard<mutex> lock(_mutex);
+                for (int i = 0; i < numHelpers; i++) _tasks.emplace(work);
+            }
+            _cv.notify_all();
+            work();
+            unique_lock<mutex> lock(state->guard);
+            state->finished.wait(lock, [&state] { return state->remaining == 0; });
+            if (state->error) rethrow_exception(state->error);
+#endif
+        }
+};
+
+/**
+ * @brief Single worker thread running tasks one at a time in submission order,
+ * like one stage of a pipeline. At most capacity tasks wait in the queue, submit
+ * blocks while it is full. The WASM build runs every task inline.
+ */
+class SerialExecutor {
+    protected:
+#if !WASM_COMPILE
+        thread _worker;
+        queue<function<void()>> _tasks;
+        size_t _capacity;
+        mutex _mutex;
+        condition_variable _cvTask;
+        condition_variable _cvSpace;
+        bool _stop = false;
+
+        void run_worker() {
+            while (true) {
+                function<void()> task;
+                {
+                    unique_lock<mutex> lock(_mutex);
+                    _cvTask.wait(lock, [this] { return _stop || !_tasks.empty(); });
+                    if (_stop && _tasks.empty()) return;
+                    task = std::move(_tasks.front());
+                    _tasks.pop();
+                }
+                _cvSpace.notify_one();
+                task();
+            }
+        }
+#endif
+
+    public:
+        /**
+         * @brief Construct a new Serial Executor
+         *
+         * @param capacity Maximum number of queued tasks, at least 1
+         */
+        SerialExecutor(int capacity) {
+#if !WASM_COMPILE
+            _capacity = (size_t)max(capacity, 1);
+            _worker = thread([this] { run_worker(); });
+#endif
+        }
+
+        //Runs the queued tasks before returning
+        ~SerialExecutor() {
+#if !WASM_COMPILE
+            {
+                lock_guard<mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cvTask.notify_all();
+            _worker.join();
+#endif
+        }
+
+        SerialExecutor(const SerialExecutor&) = delete;
+        SerialExecutor& operator=(const SerialExecutor&) = delete;
+
+        /**
+         * @brief Queue a task after the previously submitted ones. The returned
+         * future holds the result or the exception thrown by the task.
+         *
+         * @param fn
+         * @return future<R>
+         */
+        template<typename F, typename R = invoke_result_t<F>>
+        future<R> submit(F&& fn) {
+            auto task = make_shared<packaged_task<R()>>(std::forward<F>(fn));
+            auto result = task->get_future();
+#if !WASM_COMPILE
+            {
+                unique_lock<mutex> lock(_mutex);
+                _cvSpace.wait(lock, [this] { return _tasks.size() < _capacity; });
+                _tasks.emplace([task] { (*task)(); });
+            }
+            _cvTask.notify_one();
+#else
+            (*task)();
+#endif
+            return result;
+        }
+};
+
+#endif /* __THREAD_POOL_HPP__ */
@@ -21,6 +21,7 @@
 #include "g2o/types/sba/parameter_cameraparameters.h"
 #include "g2o/types/slam3d/se3quat.h"
 #include "../types/types.hpp"
+#include "hamming.hpp"
 
 
 using namespace std;
@@ -51,103 +52,46 @@ class TransformUtils {
             deg[2] = trim(degScl*euler[2]);
         }
         
-        static double get_distance(SP<Landmark> landmark, const Mat& desc, SP<Frame> descFrame, SP<FrameSet> descriptorFrames) {
-            double minDistance = INITIAL_DISTANCE;
-            // cout<<"Get distance "<<landmark->id<<endl;
-            double minFrameDist = -1;
-            SP<FramePoint> minFp;
-            for (auto fp : landmark->fps) {
-                if (descriptorFrames->count(fp->frame) == 0) continue;
-                auto frameDist = (fp->frame->pose->trans - descFrame->pose->trans).norm();
-                if (!minFp || minFrameDist > frameDist) {
-                    minFrameDist = frameDist;
-                    minFp = fp;
-                }
-            }
-            assert(minFp);
-            auto distance = norm(desc, minFp->desc, NORM_HAMMING);
+        //Landmarks are compared through their representative descriptor
+        static double get_distance(SP<Landmark> landmark, const uchar* desc) {
+            auto distance = HammingDistance::distance(desc, landmark->desc);
             if (distance > 100) return INITIAL_DISTANCE;
             else return distance;
-            // for (auto fp : landmark->fps) {
-            //     auto frame = fp->frame;
-            //     if (!frame->isCurrFrame && !frame->isKeyFrame) continue;
-                // cout<<"Getting distance from frame id"<<point2D->frameId<<" : "<<point2D->id<<endl;
-                // double distance = norm(desc, fp->desc, NORM_HAMMING);
-                // // cout<<"Landmark distance: "<<distance<<endl;
-                // if (distance < minDistance) {
-                //     minDistance = distance;
-                // } else if (distance > 100) {
-                //     return INITIAL_DISTANCE;
-                // }
-            // }
-            return minDistance;
         }
 
-        static double get_distance(SP<Landmark> landmark1, SP<Landmark> landmark2, SP<FrameSet> descriptorFrames) {
-            double minFrameDist = -1;
-            SP<FramePoint> minFp1, minFp2;
-            for (auto fp1 : landmark1->fps) {
-                if (descriptorFrames->count(fp1->frame) == 0) continue;
-                for (auto fp2 : landmark2->fps) {
-                    if (descriptorFrames->count(fp2->frame) == 0) continue;
-                    auto frameDist = (fp1->frame->pose->trans - fp2->frame->pose->trans).norm();
-                    if (!minFp1 || minFrameDist > frameDist) {
-                        minFrameDist = frameDist;
-                        minFp1 = fp1;
-                        minFp2 = fp2;
-                    }
-                }
-            }
-            assert(minFp1);
-
-            auto distance = norm(minFp1->desc, minFp2->desc, NORM_HAMMING);
+        static double get_distance(SP<Landmark> landmark1, SP<Landmark> landmark2) {
+            auto distance = HammingDistance::distance(landmark1->desc, landmark2->desc);
             if (distance > 100) return INITIAL_DISTANCE;
             else return distance;
-
-
-            // double minDistance = INITIAL_DISTANCE;
-            // for (auto fp : landmark2->fps) {
-            //     auto frame = fp->frame;
-            //     if (!frame->isCurrFrame && !frame->isKeyFrame) continue;
-            //     double distance = get_distance(landmark1, fp->desc, fp->frame);
-            //     if (distance < minDistance) {
-            //         minDistance = distance;
-            //     } else if (distance > 100) {
-            //         return INITIAL_DISTANCE;
-            //     }
-            // }
-            // return minDistance;
         }
 
-        static double get_distance(SP<FramePoint> fp1, SP<FramePoint> fp2, SP<FrameSet> descriptorFrames) {
-            if (fp1->landmark.expired() && fp2->landmark.expired()) {
-                // cout<<"Desc Dist, no landmark found"<<norm(desc1, desc2, NORM_HAMMING)<<endl;
-                return norm(fp1->desc, fp2->desc, NORM_HAMMING);
-            } else if (!fp1->landmark.expired()) {
-                // cout<<"Desc Dist, landmark1 found"<<landmark1.get_distance(desc2)<<endl;
-                return get_distance(fp1->landmark.lock(), fp2->desc, fp2->frame, descriptorFrames);
-            } else if (!fp2->landmark.expired()) {
-                // cout<<"Desc Dist, landmark2 found"<<landmark2.get_distance(desc1)<<endl;
-                // cout<<"Landmark 2 found"<<fp1->frameId<<endl;
-                return get_distance(fp2->landmark.lock(), fp1->desc, fp1->frame, descriptorFrames);
+        static double get_distance(SP<FramePoint> fp1, SP<FramePoint> fp2) {
+            auto landmark1 = fp1->landmark.lock();
+            auto landmark2 = fp2->landmark.lock();
+            if (!landmark1 && !landmark2) {
+                return HammingDistance::distance(fp1->desc(), fp2->desc());
+            } else if (landmark1 && !landmark2) {
+                return get_distance(landmark1, fp2->desc());
+            } else if (landmark2 && !landmark1) {
+                return get_distance(landmark2, fp1->desc());
             } else {
-                // cout<<"Desc Dist, landmark1 and 2 found"<<landmark1.get_distance(landmark2)<<endl;
-                return get_distance(fp1->landmark.lock(), fp2->landmark.lock(), descriptorFrames);
+                return get_distance(landmark1, landmark2);
             }
         }
 
-        static double get_distance(SP<Landmark> landmark, SP<FramePoint> fp, SP<FrameSet> descriptorFrames) {
-            if (fp->landmark.expired()) return get_distance(landmark, fp->desc, fp->frame, descriptorFrames);
-            else return get_distance(landmark, fp->landmark.lock(), descriptorFrames);
+        static double get_distance(SP<Landmark> landmark, SP<FramePoint> fp) {
+            auto fpLandmark = fp->landmark.lock();
+            if (!fpLandmark) return get_distance(landmark, fp->desc());
+            else return get_distance(landmark, fpLandmark);
         }
 
         static double get_distance(SP<FramePoint> fp, float px, float py) {
-            return sqrt(pow(fp->x - px, 2) + pow(fp->y - py, 2));
+            return sqrt(pow(fp->x() - px, 2) + pow(fp->y() - py, 2));
         }
 
         static bool within_range(SP<FramePoint> fp, double x, double y, float inlierRange, 
                 bool normalizeKP, const Mat& cameraMatrix, const Mat& distCoeffs) {
-            double fpx = fp->x, fpy = fp->y;
+            double fpx = fp->x(), fpy = fp->y();
             auto range = inlierRange;
 // #if !WASM_COMPILE
             if (normalizeKP) {
@@ -155,7 +99,7 @@ class TransformUtils {
                 vector<cv::Point2f> undistortedKeypoints;
                 cv::undistortPoints(keypoints, undistortedKeypoints, cameraMatrix, distCoeffs);
                 auto undistort = undistortedKeypoints[0];
-                // cout<<fp->x<<","<<fp->y<<" Undistort "<<undistort.x<<", "<<undistort.y<<endl;
+                // cout<<fp->x()<<","<<fp->y()<<" Undistort "<<undistort.x<<", "<<undistort.y<<endl;
                 fpx = undistort.x;
                 fpy = undistort.y;
                 range = inlierRange/cameraMatrix.at<double>(0, 0);
@@ -173,14 +117,14 @@ class TransformUtils {
 
         static double gap(SP<FramePoint> fp, double x, double y, 
                 bool normalizeKP, const Mat& cameraMatrix, const Mat& distCoeffs) {
-            double fpx = fp->x, fpy = fp->y;
+            double fpx = fp->x(), fpy = fp->y();
 // #if !WASM_COMPILE
             if (normalizeKP) {
                 vector<cv::Point2f> keypoints{Point2f(fpx, fpy)};
                 vector<cv::Point2f> undistortedKeypoints;
                 cv::undistortPoints(keypoints, undistortedKeypoints, cameraMatrix, distCoeffs);
                 auto undistort = undistortedKeypoints[0];
-                // cout<<fp->x<<","<<fp->y<<" Undistort "<<undistort.x<<", "<<undistort.y<<endl;
+                // cout<<fp->x()<<","<<fp->y()<<" Undistort "<<undistort.x<<", "<<undistort.y<<endl;
                 fpx = undistort.x;
                 fpy = undistort.y;
             }
@@ -228,17 +172,17 @@ class TransformUtils {
             return cam->cam_map(originNoRot.map(diffTrans));
         }
 
-        template<typename T> static T pop_random(set<T>& tSet) {
+        template<typename T, bool Bits, typename R> static SP<T> pop_random(SlotSet<T, Bits>& tSet, R& rng) {
             auto it = std::begin(tSet);
-            std::advance(it, rand() % tSet.size());
+            std::advance(it, rng() % tSet.size());
             auto element = *it;
             tSet.erase(element);
             return element;
         }
 
-        template<typename T> static T pop_random(vector<T>& vec) {
+        template<typename T, typename R> static T pop_random(vector<T>& vec, R& rng) {
             auto it = std::begin(vec);
-            std::advance(it, rand() % vec.size());
+            std::advance(it, rng() % vec.size());
             auto element = *it;
             vec.erase(it);
             return element;
@@ -0,0 +1,457 @@
+/**
+ * @file vocabulary.hpp
+ * @brief Visual vocabulary over the ORB descriptors, used to describe a frame as a
+ * bag of words. The vocabulary is a tree built by hierarchical k-majority clustering
+ * (k-means for binary descriptors, every center bit is the majority bit of its
+ * cluster). A descriptor is quantized to a word by descending to the nearest child
+ * on every level until a leaf is reached. Like MatchIndex, nodes are stored breadth
+ * first and the children of a node are a contiguous range of nodes, so the child
+ * descriptors are compared in a single pass.
+ * A vocabulary is either trained online or trained offline on a descriptor dump by
+ * vocabularyTrainer and loaded with load.
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef __VOCABULARY_HPP__
+#define __VOCABULARY_HPP__
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <iostream>
+#include <opencv2/core/core.hpp>
+#include "hamming.hpp"
+
+using namespace std;
+
+//Sparse bag of words, (word, weight) pairs sorted by word with the weights summing to 1
+using BowVector = vector<pair<int, float>>;
+
+struct VocabularyNode {
+    int childBegin; //Children are the nodes [childBegin, childEnd), empty for a leaf
+    int childEnd;
+    int word;       //Word id of a leaf, -1 for the other nodes
+    float weight;   //Weight of the word of a leaf
+};
+
+//Header of a saved vocabulary, followed by the nodes and the node descriptors
+struct VocabularyHeader {
+    char magic[4];  //"VOCB"
+    int32_t version;
+    int32_t nodeSize;
+};
+
+#define VOCABULARY_VERSION 1
+//Floor of the word weights, so words seen in every training image still count
+#define VOCABULARY_MIN_WEIGHT 0.01f
+
+class Vocabulary {
+    public:
+        //Nodes breadth first, node 0 is the root
+        vector<VocabularyNode> nodes;
+        //DESC_BYTES per node, the cluster center. The root has none and is all zeros.
+        vector<uchar> descs;
+        //Leaf node of every word
+        vector<int> wordNodes;
+
+        bool empty() const { return wordNodes.empty(); }
+
+        int word_count() const { return (int)wordNodes.size(); }
+
+        /**
+         * @brief Build the tree over the rows of trainDescs, replacing the current one.
+         * Every word gets a weight of 1.
+         *
+         * @param trainDescs N x DESC_BYTES CV_8UC1 continuous descriptor matrix
+         * @param branchSize Clusters per node
+         * @param depth Levels below the root
+         * @param iterations Max k-majority iterations per node
+         * @param seed Seed of the engine picking the initial centers
+         */
+        void train(const cv::Mat& trainDescs, int branchSize, int depth, int iterations = 5, unsigned seed = 0) {
+            const int n = trainDescs.rows;
+            _rng.seed(seed);
+            nodes.clear();
+            descs.clear();
+            wordNodes.clear();
+            _segBegin.clear();
+            _segEnd.clear();
+            _levels.clear();
+            _perm.resize(n);
+            iota(_perm.begin(), _perm.end(), 0);
+            _assign.resize(n);
+            _sorted.resize(n);
+            _centers.resize((size_t)branchSize*DESC_BYTES);
+            _centerDistances.resize(branchSize);
+            _counts.resize(branchSize + 1);
+
+            add_node(nullptr, 0, n, 0);
+            for (int i = 0; i < (int)nodes.size(); i++) {
+                nodes[i].childBegin = (int)nodes.size();
+                if (_levels[i] < depth && _segEnd[i] - _segBegin[i] > branchSize)
+                    split(trainDescs, i, branchSize, iterations);
+                nodes[i].childEnd = (int)nodes.size();
+            }
+            link();
+        }
+
+        /**
+         * @brief Set every word weight to its inverse document frequency log(N/n) over
+         * the N training images, n being the images the word appears in. Words that
+         * appear in no image get log(N). Words in every image, e.g. all of them with a
+         * single image, get VOCABULARY_MIN_WEIGHT instead of 0, which transform would drop.
+         *
+         * @param images Descriptor matrix of every training image
+         */
+        void set_idf(const vector<cv::Mat>& images) {
+            vector<int> imageCounts(word_count(), 0);
+            vector<int> words;
+            for (auto& image : images) {
+                words.resize(image.rows);
+                for (int i = 0; i < image.rows; i++) words[i] = lookup(image.ptr(i));
+                sort(words.begin(), words.end());
+                words.erase(unique(words.begin(), words.end()), words.end());
+                for (int word : words) imageCounts[word]++;
+            }
+            for (int word = 0; word < word_count(); word++) {
+                float count = imageCounts[word] > 0? imageCounts[word] : 1;
+                nodes[wordNodes[word]].weight = max((float)log(images.size()/count), VOCABULARY_MIN_WEIGHT);
+            }
+        }
+
+        /**
+         * @brief Write the vocabulary, see VocabularyHeader
+         *
+         * @param out Binary stream
+         */
+        void save(ostream& out) const {
+            VocabularyHeader header{{'V', 'O', 'C', 'B'}, VOCABULARY_VERSION, (int32_t)nodes.size()};
+            out.write((const char*)&header, sizeof(header));
+            out.write((const char*)nodes.data(), nodes.size()*sizeof(VocabularyNode));
+            out.write((const char*)descs.data(), descs.size());
+        }
+
+        /**
+         * @brief Replace the vocabulary with one written by save
+         *
+         * @param in Binary stream
+         * @return bool False if the stream does not hold a vocabulary of this version,
+         * the vocabulary is left empty then
+         */
+        bool load(istream& in) {
+            nodes.clear();
+            descs.clear();
+            wordNodes.clear();
+            VocabularyHeader header;
+            if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "VOCB", 4) != 0 ||
+                    header.version != VOCABULARY_VERSION || header.nodeSize <= 0) return false;
+            nodes.resize(header.nodeSize);
+            descs.resize((size_t)header.nodeSize*DESC_BYTES);
+            bool valid = in.read((char*)nodes.data(), nodes.size()*sizeof(VocabularyNode)) &&
+                in.read((char*)descs.data(), descs.size());
+            //Children come after their parent, at most MAX_BRANCH of them, and every node
+            //but the root is the child of exactly one node. Weights are finite and not negative.
+            vector<int> parentCounts(header.nodeSize, 0);
+            for (int i = 0; valid && i < header.nodeSize; i++) {
+                auto& node = nodes[i];
+                valid = (node.childBegin == node.childEnd || (node.childBegin > i &&
+                    node.childBegin < node.childEnd && node.childEnd <= header.nodeSize &&
+                    node.childEnd - node.childBegin <= MAX_BRANCH)) &&
+                    isfinite(node.weight) && node.weight >= 0;
+                for (int child = node.childBegin; valid && child < node.childEnd; child++) parentCounts[child]++;
+            }
+            for (int i = 0; valid && i < header.nodeSize; i++) valid = parentCounts[i] == (i == 0? 0 : 1);
+            if (!valid) {
+                nodes.clear();
+                descs.clear();
+                return false;
+            }
+            link();
+            return true;
+        }
+
+        /**
+         * @brief Node at level of the path from the root to the leaf of word. Level 0
+         * is the root, a level below the leaf gives the leaf.
+         *
+         * @param word
+         * @param level
+         * @return int
+         */
+        int ancestor(int word, int level) const {
+            int node = wordNodes[word];
+            while (_levels[node] > level) node = _parents[node];
+            return node;
+        }
+
+        /**
+         * @brief Word of a descriptor
+         *
+         * @param desc DESC_BYTES descriptor
+         * @return int
+         */
+        int lookup(const uchar* desc) const {
+            int distances[MAX_BRANCH];
+            int node = 0;
+            while (nodes[node].childBegin < nodes[node].childEnd) {
+                const int begin = nodes[node].childBegin;
+                const int count = nodes[node].childEnd - begin;
+                HammingDistance::distances(desc, &descs[(size_t)begin*DESC_BYTES], count, distances);
+                node = begin + (int)(min_element(distances, distances + count) - distances);
+            }
+            return nodes[node].word;
+        }
+
+        /**
+         * @brief Bag of words of the rows of descs
+         *
+         * @param descsArg N x DESC_BYTES CV_8UC1 continuous descriptor matrix
+         * @return BowVector Empty if the vocabulary or descs are empty
+         */
+        BowVector transform(const cv::Mat& descsArg) const {
+            if (empty()) return BowVector();
+            vector<int> words(descsArg.rows);
+            for (int i = 0; i < descsArg.rows; i++) words[i] = lookup(descsArg.ptr(i));
+            return transform(words.data(), (int)words.size());
+        }
+
+        /**
+         * @brief Bag of words of descriptors already quantized by lookup
+         *
+         * @param wordsArg
+         * @param n
+         * @return BowVector
+         */
+        BowVector transform(const int* wordsArg, int n) const {
+            BowVector bow;
+            if (empty() || n == 0) return bow;
+            vector<int> words(wordsArg, wordsArg + n);
+            sort(words.begin(), words.end());
+
+            float total = 0;
+            for (int i = 0; i < (int)words.size();) {
+                int j = i;
+                while (j < (int)words.size() && words[j] == words[i]) j++;
+                float weight = (j - i) * nodes[wordNodes[words[i]]].weight;
+                if (weight > 0) {
+                    bow.push_back(make_pair(words[i], weight));
+                    total += weight;
+                }
+                i = j;
+            }
+            for (auto& entry : bow) entry.second /= total;
+            return bow;
+        }
+
+        /**
+         * @brief L1 similarity of two bags of words, in [0, 1]
+         *
+         * @param a
+         * @param b
+         * @return float
+         */
+        static float score(const BowVector& a, const BowVector& b) {
+            float score = 0;
+            auto itA = a.begin();
+            auto itB = b.begin();
+            while (itA != a.end() && itB != b.end()) {
+                if (itA->first < itB->first) itA++;
+                else if (itB->first < itA->first) itB++;
+                else {
+                    score += min(itA->second, itB->second);
+                    itA++;
+                    itB++;
+                }
+            }
+            return score;
+        }
+
+        /**
+         * @brief Append the descriptors of an image to a descriptor dump, the input of
+         * vocabularyTrainer. Every image is an int32 count followed by the descriptors.
+         *
+         * @param out Binary stream
+         * @param imageDescs N x DESC_BYTES CV_8UC1 continuous descriptor matrix
+         */
+        static void write_dump(ostream& out, const cv::Mat& imageDescs) {
+            int32_t count = imageDescs.rows;
+            out.write((const char*)&count, sizeof(count));
+            if (count > 0) out.write((const char*)imageDescs.ptr(), (size_t)count*DESC_BYTES);
+        }
+
+        /**
+         * @brief Descriptors of every image of a descriptor dump
+         *
+         * @param in Binary stream
+         * @return vector<cv::Mat>
+         */
+        static vector<cv::Mat> read_dump(istream& in) {
+            vector<cv::Mat> images;
+            int32_t count;
+            while (in.read((char*)&count, sizeof(count)) && count >= 0) {
+                cv::Mat image(count, DESC_BYTES, CV_8UC1);
+                if (count > 0 && !in.read((char*)image.ptr(), (size_t)count*DESC_BYTES)) break;
+                images.push_back(image);
+            }
+            return images;
+        }
+
+        static constexpr int MAX_BRANCH = 64;
+
+    protected:
+        //Training descriptors left to cluster under node i are [_segBegin[i], _segEnd[i]) of _perm
+        vector<int> _perm;
+        vector<int> _segBegin;
+        vector<int> _segEnd;
+        //Level and parent of every node, the root is at level 0
+        vector<int> _levels;
+        vector<int> _parents;
+        vector<int> _assign;
+        vector<int> _sorted;
+        vector<int> _counts;
+        vector<uchar> _centers;
+        vector<int> _centerDistances;
+        mt19937 _rng;
+
+        //Numbers the leaves as words and sets the level and parent of every node
+        void link() {
+            wordNodes.clear();
+            _levels.assign(nodes.size(), 0);
+            _parents.assign(nodes.size(), -1);
+            for (int i = 0; i < (int)nodes.size(); i++) {
+                for (int child = nodes[i].childBegin; child < nodes[i].childEnd; child++) {
+                    _levels[child] = _levels[i] + 1;
+                    _parents[child] = i;
+                }
+                if (nodes[i].childBegin == nodes[i].childEnd) {
+                    nodes[i].word = (int)wordNodes.size();
+                    wordNodes.push_back(i);
+                } else {
+                    nodes[i].word = -1;
+                }
+            }
+        }
+
+        void add_node(const uchar* desc, int segBegin, int segEnd, int level) {
+            nodes.push_back({0, 0, -1, 1.0f});
+            descs.resize(descs.size() + DESC_BYTES, 0);
+            if (desc) memcpy(&descs[descs.size() - DESC_BYTES], desc, DESC_BYTES);
+            _segBegin.push_back(segBegin);
+            _segEnd.push_back(segEnd);
+            _levels.push_back(level);
+        }
+
+        //Clusters the training descriptors of node into at most branchSize children
+        void split(const cv::Mat& trainDescs, int node, int branchSize, int iterations) {
+            const int begin = _segBegin[node];
+            const int end = _segEnd[node];
+            const int count = end - begin;
+            int k = min(branchSize, MAX_BRANCH);
+
+            //Seeds are random distinct descriptors of the node
+            for (int c = 0; c < k; c++) {
+                int pick = begin + c + _rng() % (count - c);
+                swap(_perm[begin + c], _perm[pick]);
+                memcpy(&_centers[c*DESC_BYTES], trainDescs.ptr(_perm[begin + c]), DESC_BYTES);
+            }
+            for (int i = begin; i < end; i++) _assign[i] = -1;
+
+            //At least one pass, every descriptor needs a cluster
+            for (int iter = 0; iter < max(iterations, 1); iter++) {
+                bool changed = false;
+                for (int i = begin; i < end; i++) {
+                    HammingDistance::distances(trainDescs.ptr(_perm[i]), _centers.data(), k, _centerDistances.data());
+                    int nearest = (int)(min_element(_centerDistances.begin(), _centerDistances.begin() + k) -
+                        _centerDistances.begin());
+                    if (_assign[i] != nearest) changed = true;
+                    _assign[i] = nearest;
+                }
+                if (!changed) break;
+                k = update_centers(trainDescs, begin, end, k);
+            }
+
+            //Counting sort of the range by cluster, every cluster becomes a child
+            fill(_counts.begin(), _counts.begin() + k + 1, 0);
+            for (int i = begin; i < end; i++) _counts[_assign[i] + 1]++;
+            for (int c = 0; c < k; c++) _counts[c + 1] += _counts[c];
+            for (int c = 0; c < k; c++)
+                add_node(&_centers[c*DESC_BYTES], begin + _counts[c], begin + _counts[c + 1], _levels[node] + 1);
+            for (int i = begin; i < end; i++) _sorted[begin + _counts[_assign[i]]++] = _perm[i];
+            copy(_sorted.begin() + begin, _sorted.begin() + end, _perm.begin() + begin);
+        }
+
+        //Sets every center to the bitwise majority of its cluster. Empty clusters are
+        //dropped and the others renumbered, returns the number of clusters left.
+        int update_centers(const cv::Mat& trainDescs, int begin, int end, int k) {
+            vector<int> bitCounts((size_t)k*DESC_BYTES*8, 0);
+            fill(_counts.begin(), _counts.begin() + k, 0);
+            for (int i = begin; i < end; i++) {
+                const uchar* desc = trainDescs.ptr(_perm[i]);
+                int* bits = &bitCounts[(size_t)_assign[i]*DESC_BYTES*8];
+                for (int b = 0; b < DESC_BYTES*8; b++) bits[b] += (desc[b >> 3] >> (b & 7)) & 1;
+                _counts[_assign[i]]++;
+            }
+
+            vector<int> renumber(k, -1);
+            int kept = 0;
+            for (int c = 0; c < k; c++) {
+                if (_counts[c] == 0) continue;
+                uchar* center = &_centers[kept*DESC_BYTES];
+                memset(center, 0, DESC_BYTES);
+                const int* bits = &bitCounts[(size_t)c*DESC_BYTES*8];
+                for (int b = 0; b < DESC_BYTES*8; b++)
+                    if (2*bits[b] > _counts[c]) center[b >> 3] |= (uchar)(1 << (b & 7));
+                renumber[c] = kept++;
+            }
+            for (int i = begin; i < end; i++) _assign[i] = renumber[_assign[i]];
+            return kept;
+        }
+};
+
+//Keypoints of a frame grouped by the node of their word at one level of a vocabulary.
+//Keypoints that share a node are the match candidates of each other.
+class VocabularyIndex {
+    public:
+        /**
+         * @brief Group the keypoints by node
+         *
+         * @param vocabulary
+         * @param words Word of every keypoint, -1 for a keypoint that is not grouped
+         * @param n
+         * @param level
+         */
+        void build(const Vocabulary& vocabulary, const int* words, int n, int level) {
+            _nodes.resize(n);
+            _indices.clear();
+            for (int i = 0; i < n; i++) {
+                _nodes[i] = words[i] < 0? -1 : vocabulary.ancestor(words[i], level);
+                if (_nodes[i] >= 0) _indices.push_back(i);
+            }
+            stable_sort(_indices.begin(), _indices.end(), [this](int a, int b) { return _nodes[a] < _nodes[b]; });
+            _sortedNodes.resize(_indices.size());
+            for (int k = 0; k < (int)_indices.size(); k++) _sortedNodes[k] = _nodes[_indices[k]];
+        }
+
+        //Node of the keypoint at index, -1 if it is not grouped
+        int node(int index) const { return _nodes[index]; }
+
+        //Calls fn(index) for every keypoint of node
+        template<typename F> void query(int node, F fn) const {
+            if (node < 0) return;
+            auto range = equal_range(_sortedNodes.begin(), _sortedNodes.end(), node);
+            for (auto it = range.first; it != range.second; it++) fn(_indices[it - _sortedNodes.begin()]);
+        }
+
+    protected:
+        vector<int> _nodes;
+        vector<int> _indices;       //Grouped keypoints sorted by node
+        vector<int> _sortedNodes;   //Node of every entry of _indices
+};
+
+#endif /* __VOCABULARY_HPP__ */
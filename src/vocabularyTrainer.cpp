@@ -0,0 +1,60 @@
+/**
+ * @file vocabularyTrainer.cpp
+ * @brief Executable that trains the vocabulary loaded by Slam::load_vocabulary from a
+ * descriptor dump, as written by slamTester with the descriptorDump config.
+ * Usage: vocabularyTrainer <descriptorDump> <vocabularyOut> [branchSize=10] [depth=4] [iterations=10] [seed=0]
+ * @author Parikshit Basu
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+
+#include "utils/vocabulary.hpp"
+#include "utils/timer.hpp"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cout<<"Usage: "<<argv[0]<<" <descriptorDump> <vocabularyOut> [branchSize=10] [depth=4] [iterations=10] [seed=0]"<<endl;
+        return 1;
+    }
+    int branchSize = argc > 3? atoi(argv[3]) : 10;
+    int depth = argc > 4? atoi(argv[4]) : 4;
+    int iterations = argc > 5? atoi(argv[5]) : 10;
+    unsigned seed = argc > 6? (unsigned)strtoul(argv[6], nullptr, 10) : 0;
+    if (branchSize < 2 || branchSize > Vocabulary::MAX_BRANCH || depth < 1 || iterations < 1) {
+        cout<<"branchSize must be in [2, "<<Vocabulary::MAX_BRANCH<<"], depth and iterations at least 1"<<endl;
+        return 1;
+    }
+
+    ifstream dumpFile(argv[1], ios::binary);
+    auto images = Vocabulary::read_dump(dumpFile);
+    cv::Mat descs;
+    if (images.size() > 0) cv::vconcat(images, descs);
+    if (descs.rows == 0) {
+        cout<<"No descriptors in "<<argv[1]<<endl;
+        return 1;
+    }
+    cout<<"Training on "<<descs.rows<<" descriptors of "<<images.size()<<" images"<<endl;
+
+    auto startTime = Timer::time();
+    Vocabulary vocabulary;
+    vocabulary.train(descs, branchSize, depth, iterations, seed);
+    vocabulary.set_idf(images);
+    cout<<"Words "<<vocabulary.word_count()<<" Nodes "<<vocabulary.nodes.size()<<" Time "<<Timer::diff(startTime)<<endl;
+
+    ofstream out(argv[2], ios::binary);
+    vocabulary.save(out);
+    if (!out) {
+        cout<<"Could not write "<<argv[2]<<endl;
+        return 1;
+    }
+    return 0;
+}